@@ -0,0 +1,310 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "packet.h"
+
+// Load generator: bots race as fast as the server hands out words and
+// record completion -> next word latency. With the server's admin socket it
+// also reports reactor syscalls per completed word. No hand types this
+// fast: the server has to run with -t for its timing checks to let bots in.
+
+#define     MAX_BOTS        4
+#define     MAX_SAMPLES     65536
+// Words handed out but not completed yet, by hash
+#define     BOT_WORDS       16
+
+typedef struct bot_s
+{
+    int         socket;
+    int         player_id;
+    int         words;
+    int         pending;
+    uint32_t    hashes[BOT_WORDS];
+    int64_t     sent;
+    size_t      filled;
+    char        buffer[sizeof(packet_t)];
+} bot_t;
+
+typedef struct bench_s
+{
+    bot_t       bots[MAX_BOTS];
+    int         bot_count;
+    int         joined;
+    int         running;
+    int         races;
+    int64_t     samples[MAX_SAMPLES];
+    size_t      sample_count;
+} bench_t;
+
+static inline int64_t clock_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+
+
+/////////// NETWORK ////////////
+
+int net_connect(const char *host, int port) {
+    struct sockaddr_in serv = {.sin_family=PF_INET, .sin_port=htons(port)};
+    int one = 1;
+    int sockfd;
+
+    serv.sin_addr.s_addr = inet_addr(host);
+    if ((sockfd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0
+        || connect(sockfd, (struct sockaddr *)&serv, sizeof(serv)) < 0) {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sockfd;
+}
+
+void net_send(bot_t *bot, const packet_t *packet) {
+    if (send(bot->socket, packet, sizeof(packet_t), MSG_NOSIGNAL) != sizeof(packet_t)) {
+        perror("send");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Scrapes one counter from the server's admin socket, 0 if unavailable
+uint64_t admin_counter(const char *path, const char *name) {
+    static char BUFFER[65536];
+    struct sockaddr_un addr = {.sun_family=AF_UNIX};
+    size_t len = 0;
+    ssize_t size;
+    char *pch;
+    int sockfd;
+
+    if (path == NULL || strlen(path) >= sizeof(addr.sun_path))
+        return 0;
+    strcpy(addr.sun_path, path);
+    if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return 0;
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sockfd);
+        return 0;
+    }
+    while (len < sizeof(BUFFER) - 1 && (size = read(sockfd, BUFFER + len, sizeof(BUFFER) - 1 - len)) > 0)
+        len += size;
+    close(sockfd);
+    BUFFER[len] = 0;
+    for (pch = BUFFER; (pch = strstr(pch, name)) != NULL; pch += strlen(name))
+        if ((pch == BUFFER || pch[-1] == '\n') && pch[strlen(name)] == ' ')
+            return strtoull(pch + strlen(name) + 1, NULL, 10);
+    return 0;
+}
+
+
+
+/////////// BOTS ////////////
+
+void bot_complete(bot_t *bot) {
+    uint32_t hash = bot->hashes[(bot->words - bot->pending) % BOT_WORDS];
+
+    bot->sent = clock_now_ns();
+    bot->pending--;
+    net_send(bot, &(packet_t){.id=CLIENT_WORD_COMPLETE, .packet.client.word_complete={.hash=hash}});
+}
+
+void bot_handle_packet(bench_t *bench, bot_t *bot, const packet_t *packet) {
+    switch (packet->id)
+    {
+    case SERVER_GAME_STATUS:
+        if (packet->packet.server.game_status.state == RUNNING && !bench->running) {
+            bench->running = 1;
+            for (int i = 0; i < bench->joined; ++i)
+                if (bench->bots[i].pending > 0 && bench->bots[i].sent == 0)
+                    bot_complete(bench->bots + i);
+        } else if (packet->packet.server.game_status.state == WAITTING && bench->running) {
+            bench->running = 0;
+            bench->races--;
+            for (int i = 0; i < bench->joined; ++i) {
+                bench->bots[i].words = 0;
+                bench->bots[i].pending = 0;
+                bench->bots[i].sent = 0;
+            }
+        }
+        break;
+
+    case SERVER_PLAYER_ACCEPT:
+        bot->player_id = packet->packet.server.player_accept.info.player_id;
+        break;
+
+    case SERVER_NEW_WORD:
+        // The start words are not answers to a completion
+        bot->pending++;
+        bot->hashes[bot->words % BOT_WORDS] = packet_word_hash(packet->packet.server.new_word.word);
+        if (++bot->words > MAX_START_WORDS && bot->sent != 0) {
+            if (bench->sample_count < MAX_SAMPLES)
+                bench->samples[bench->sample_count++] = clock_now_ns() - bot->sent;
+            bot->sent = 0;
+        }
+        if (bench->running && bot->sent == 0)
+            bot_complete(bot);
+        break;
+
+    case SERVER_PING:
+        net_send(bot, &(packet_t){.id=CLIENT_PONG, .packet.client.pong={
+            .sent=packet->packet.server.ping.sent,
+            .received=clock_now_ns()
+        }});
+        break;
+
+    default:
+        break;
+    }
+}
+
+void bot_read(bench_t *bench, bot_t *bot) {
+    char data[4096];
+    ssize_t size = read(bot->socket, data, sizeof(data));
+    packet_t packet;
+    size_t chunk;
+
+    if (size <= 0) {
+        fprintf(stderr, "[ERROR] Bot %d lost its connection\n", bot->player_id);
+        exit(EXIT_FAILURE);
+    }
+    for (char *pch = data; size > 0; pch += chunk, size -= chunk) {
+        chunk = sizeof(packet_t) - bot->filled;
+        if (chunk > (size_t)size)
+            chunk = size;
+        memcpy(bot->buffer + bot->filled, pch, chunk);
+        if ((bot->filled += chunk) < sizeof(packet_t))
+            break;
+        bot->filled = 0;
+        memcpy(&packet, bot->buffer, sizeof(packet_t));
+        bot_handle_packet(bench, bot, &packet);
+    }
+}
+
+void bench_loop(bench_t *bench) {
+    fd_set set;
+    int max_fd = -1;
+
+    FD_ZERO(&set);
+    for (int i = 0; i < bench->joined; ++i) {
+        FD_SET(bench->bots[i].socket, &set);
+        if (bench->bots[i].socket > max_fd)
+            max_fd = bench->bots[i].socket;
+    }
+    if (select(max_fd + 1, &set, NULL, NULL, NULL) < 0) {
+        perror("select");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < bench->joined; ++i)
+        if (FD_ISSET(bench->bots[i].socket, &set))
+            bot_read(bench, bench->bots + i);
+}
+
+
+
+/////////// REPORT ////////////
+
+static int compare_samples(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void bench_report(bench_t *bench, uint64_t syscalls, uint64_t words) {
+    size_t count = bench->sample_count;
+
+    if (count == 0) {
+        printf("no samples\n");
+        return;
+    }
+    qsort(bench->samples, count, sizeof(int64_t), compare_samples);
+    printf("words      %zu\n", count);
+    printf("p50        %ld us\n", bench->samples[count / 2] / 1000);
+    printf("p99        %ld us\n", bench->samples[count * 99 / 100] / 1000);
+    printf("max        %ld us\n", bench->samples[count - 1] / 1000);
+    if (words != 0)
+        printf("syscalls   %.2f per word (%lu / %lu)\n", (double)syscalls / words, syscalls, words);
+}
+
+
+
+/////////// MAIN ////////////
+
+static const char USAGE[] = "./bench [-p players] [-n races] [-a admin_socket] [host] [port]\n";
+
+int main(int ac, char **av) {
+    static bench_t bench;
+    const char *admin_path = NULL;
+    uint64_t syscalls;
+    uint64_t words;
+    int port;
+    int opt;
+
+    bench.bot_count = MAX_BOTS;
+    bench.races = 1;
+    while ((opt = getopt(ac, av, "p:n:a:")) != -1) {
+        switch (opt)
+        {
+        case 'p':
+            bench.bot_count = strtol(optarg, NULL, 10);
+            break;
+
+        case 'n':
+            bench.races = strtol(optarg, NULL, 10);
+            break;
+
+        case 'a':
+            admin_path = optarg;
+            break;
+
+        default:
+            fprintf(stderr, USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    ac -= optind - 1;
+    av += optind - 1;
+    if (ac != 3 || bench.bot_count < 2 || bench.bot_count > MAX_BOTS || bench.races < 1) {
+        fprintf(stderr, USAGE);
+        exit(EXIT_FAILURE);
+    }
+    if ((port = strtol(av[2], NULL, 10)) == 0) {
+        fprintf(stderr, "[ERROR] Invalid port: %s\n", av[2]);
+        exit(EXIT_FAILURE);
+    }
+    // The server holds a single pending connection: join one bot at a time
+    for (int i = 0; i < bench.bot_count; ++i) {
+        bot_t *bot = bench.bots + bench.joined++;
+        packet_t join = {.id=CLIENT_PLAYER_INFOS, .packet.client.player_infos={.start_words=MAX_START_WORDS}};
+
+        bot->socket = net_connect(av[1], port);
+        bot->player_id = -1;
+        snprintf(join.packet.client.player_infos.name, MAX_PLAYER_NAME_SIZE, "bench%d", i);
+        net_send(bot, &join);
+        while (bot->player_id == -1)
+            bench_loop(&bench);
+    }
+    syscalls = admin_counter(admin_path, "tr_reactor_syscalls_total");
+    words = admin_counter(admin_path, "tr_words_completed_total");
+    printf("[INFO] %d bots joined, waiting for %d race(s)\n", bench.bot_count, bench.races);
+    while (bench.races > 0)
+        bench_loop(&bench);
+    syscalls = admin_counter(admin_path, "tr_reactor_syscalls_total") - syscalls;
+    words = admin_counter(admin_path, "tr_words_completed_total") - words;
+    bench_report(&bench, syscalls, words);
+    for (int i = 0; i < bench.joined; ++i)
+        close(bench.bots[i].socket);
+    return EXIT_SUCCESS;
+}
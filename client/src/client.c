@@ -1,4 +1,6 @@
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <memory.h>
 #include <ncurses.h>
 #include <netinet/in.h>
@@ -7,42 +9,269 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/select.h>
-#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "packet.h"
 
 #define MAX_PLAYER 4
 
-typedef struct word_list_s
+// Upcoming words, allocated once for the lookahead window we negotiate with
+// the server (start_words): it never holds more than that many words
+typedef struct word_ring_s
 {
-    struct word_list_s *next;
-    char word[MAX_STRING_SIZE];
-} word_list_t;
+    char     (*words)[MAX_STRING_SIZE];
+    unsigned head;
+    unsigned tail;
+    unsigned mask;
+} word_ring_t;
 
 typedef struct scorboard_s {
     char name[MAX_PLAYER_NAME_SIZE];
     int player_id;
     int score;
+    uint32_t seq;
+    int chars;
+    int progress_word;
+    uint32_t progress_seq;
+    int place;
 } scorboard_t;
 
+// Character-level progress streaming (-p): what was last reported
+typedef struct progress_s {
+    int enabled;
+    int word;
+    int sent_word;
+    int sent_chars;
+} progress_t;
+
+// Optional datagram channel for scores, set up after the server's offer
+#define UDP_HELLO_INTERVAL 200000000
+#define UDP_HELLO_TRIES    10
+
+// A broken connection is reattached to our seat while the server holds it
+#define RESUME_WINDOW      10000000000ll
+#define RESUME_RETRY       500000000
+#define RESUME_REPLY_WAIT  1
+
+// Reads cut the stream anywhere, packets are put back together
+#define NET_READ_SIZE      4096
+
+typedef struct udp_channel_s {
+    int      socket;
+    int      ready;
+    int      tries;
+    uint32_t token;
+    uint32_t seq;
+    int64_t  next_hello;
+    uint64_t received;
+    uint64_t stale;
+} udp_channel_t;
+
+// Key read to screen-updated latency of every processed keystroke
+typedef struct input_stats_s {
+    uint64_t keys;
+    int      pending;
+    int64_t  woke;
+    int64_t  last;
+    int64_t  avg;
+    int64_t  max;
+} input_stats_t;
+
+// Keystroke analytics: the keys of a race go into a ring allocated once at
+// startup, rolling WPM and n-gram latencies are updated as they come and the
+// race is summarized when it ends. N-grams only chain correct keys of a word.
+#define ANALYTICS_EVENTS    4096
+#define ANALYTICS_WINDOW    5000000000ll
+#define ANALYTICS_IDLE      2000000000ll
+#define NGRAM_FIRST         ' '
+#define NGRAM_CHARS         95
+#define NGRAM_BUCKET_MS     10
+#define NGRAM_BUCKETS       101
+#define NGRAM_MIN_COUNT     3
+#define TRIGRAM_SLOTS       2048
+
+typedef struct keystroke_s {
+    int64_t t;
+    char    key;
+    char    correct;
+} keystroke_t;
+
+typedef struct ngram_stat_s {
+    char     key[3];
+    uint32_t count;
+    uint64_t total_us;
+} ngram_stat_t;
+
+// 10 ms buckets, the last one holds everything from a second on
+typedef struct latency_hist_s {
+    uint32_t count;
+    uint32_t buckets[NGRAM_BUCKETS];
+} latency_hist_t;
+
+typedef struct analytics_s {
+    keystroke_t            *events;
+    uint32_t                keys;
+    uint32_t                correct;
+    uint32_t                window;
+    uint32_t                window_correct;
+    int64_t                 started;
+    uint32_t                wpm;
+    uint32_t                peak_wpm;
+    int                     chain;
+    char                    recent[2];
+    int64_t                 recent_t[2];
+    ngram_stat_t           *bigrams;
+    ngram_stat_t           *trigrams;
+    latency_hist_t          bigram_hist;
+    latency_hist_t          trigram_hist;
+    int                     summarized;
+    int                     upload;
+    client_typing_summary_t summary;
+} analytics_t;
+
+// Leaderboard panel (F3): rows arrive one packet each and are shown once the
+// closing row came in
+#define LEADERBOARD_KEY  KEY_F(3)
+#define LEADERBOARD_ROWS 5
+
+typedef struct leaderboard_s {
+    int                  shown;
+    int                  count;
+    int                  filling;
+    server_leaderboard_t rows[MAX_LEADERBOARD_ROWS + 1];
+    server_leaderboard_t pending[MAX_LEADERBOARD_ROWS + 1];
+} leaderboard_t;
+
+#define OVERLAY_KEY KEY_F(2)
+
+#define DIRTY_TIMER   0x01
+#define DIRTY_SCORES  0x02
+#define DIRTY_WORD    0x04
+#define DIRTY_STATUS  0x08
+#define DIRTY_OVERLAY 0x10
+#define DIRTY_BOARD   0x20
+#define DIRTY_STATS   0x40
+#define DIRTY_ALL     0x7f
+
+#define RENDER_FPS    60
+
+typedef struct render_s {
+    int      dirty;
+    int      timer;
+    int64_t  next_frame;
+    uint64_t frames;
+    uint64_t window_bytes;
+    int64_t  window;
+    uint64_t rate;
+} render_t;
+
 typedef struct game_client_s
 {
     int                  socket;
+    struct sockaddr_in   server;
+    udp_channel_t        udp;
     fd_set               set;
     player_info_t        info;
     net_status_t         status;
     int                  running;
-    word_list_t          *words;
+    word_ring_t          words;
+    int                  lookahead;
+    int                  cursor;
     server_game_status_t game_status;
     scorboard_t          scores[MAX_PLAYER];
     int                  player_count;
+    int                  standings[MAX_PLAYER];
+    int                  ranked;
+    uint64_t             token;
+    uint32_t             received;
+    char                 pending[sizeof(packet_t)];
+    size_t               filled;
+    unsigned             streams;
+    packet_t             join;
+    input_stats_t        input;
+    uint32_t             race_keys;
+    uint32_t             race_errors;
+    int64_t              word_started;
+    progress_t           progress;
+    leaderboard_t        leaderboard;
+    analytics_t          analytics;
+    int                  overlay;
+    render_t             render;
 } game_client_t;
 
+static inline int64_t clock_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
 /////////// FORWARD DECLARATIONS ////////////
 
 void game_client_destroy(game_client_t *client);
+void game_client_rejoin(game_client_t *client);
 void game_handle_packet(game_client_t *game, int socket, const packet_t *packet);
+void input_drain(game_client_t *client);
+void input_record(game_client_t *client);
+void progress_apply(game_client_t *client, const server_progress_t *progress, uint32_t seq);
+void progress_report(game_client_t *client);
+void standings_show(game_client_t *client);
+void analytics_init(analytics_t *stats, int upload);
+void analytics_destroy(analytics_t *stats);
+void analytics_start(analytics_t *stats);
+void analytics_key(analytics_t *stats, char key, int correct, int64_t now);
+void analytics_word_end(analytics_t *stats);
+void analytics_finish(game_client_t *client);
+struct timespec render_timeout(const render_t *render);
+uint64_t terminal_bytes(void);
+
+
+
+/////////// WORDS ////////////
+
+void word_ring_init(word_ring_t *ring, int lookahead) {
+    unsigned capacity = 1;
+
+    while (capacity < (unsigned)lookahead)
+        capacity <<= 1;
+    if ((ring->words = malloc(capacity * sizeof(*ring->words))) == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = capacity - 1;
+}
+
+void word_ring_destroy(word_ring_t *ring) {
+    free(ring->words);
+    ring->words = NULL;
+}
+
+static inline unsigned word_ring_size(const word_ring_t *ring) {
+    return ring->tail - ring->head;
+}
+
+int word_ring_push(word_ring_t *ring, const packet_string_t word) {
+    if (word_ring_size(ring) > ring->mask)
+        return -1;
+    strncpy(ring->words[ring->tail++ & ring->mask], word, MAX_STRING_SIZE);
+    return 0;
+}
+
+const char *word_ring_peek(const word_ring_t *ring) {
+    return ring->head == ring->tail ? NULL : ring->words[ring->head & ring->mask];
+}
+
+void word_ring_pop(word_ring_t *ring) {
+    if (ring->head != ring->tail)
+        ring->head++;
+}
+
+void word_ring_clear(word_ring_t *ring) {
+    ring->head = ring->tail;
+}
 
 
 
@@ -66,39 +295,205 @@ void net_init(game_client_t *client, const char *host, int port) {
         exit(EXIT_FAILURE);
     }
     fprintf(stderr, "connect() called\n");
+    client->server = serv;
+    client->status = STABLE;
+}
+
+// The server offered a datagram channel: say hello from a connected UDP
+// socket until it answers, scores keep coming over TCP in the meantime
+void net_udp_open(game_client_t *client, uint32_t token) {
+    udp_channel_t *udp = &client->udp;
+
+    if (udp->socket != -1)
+        close(udp->socket);
+    udp->ready = 0;
+    udp->tries = 0;
+    udp->token = token;
+    udp->next_hello = 0;
+    if ((udp->socket = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP)) < 0
+        || connect(udp->socket, (struct sockaddr *)&client->server, sizeof(client->server)) < 0) {
+        perror("udp");
+        if (udp->socket >= 0)
+            close(udp->socket);
+        udp->socket = -1;
+    }
+}
+
+void net_udp_close(game_client_t *client) {
+    if (client->udp.socket != -1)
+        close(client->udp.socket);
+    client->udp.socket = -1;
+    client->udp.ready = 0;
+}
+
+void net_send_datagram(game_client_t *client, const packet_t *packet) {
+    datagram_t datagram = {.token=client->udp.token, .seq=++client->udp.seq, .packet=*packet};
+
+    send(client->udp.socket, &datagram, sizeof(datagram), MSG_DONTWAIT);
+}
+
+void net_udp_hello(game_client_t *client, int64_t now) {
+    udp_channel_t *udp = &client->udp;
+
+    if (udp->socket == -1 || udp->ready || now < udp->next_hello)
+        return;
+    if (udp->tries++ == UDP_HELLO_TRIES) {
+        fprintf(stderr, "[INFO] No answer on the datagram channel, staying on TCP\n");
+        net_udp_close(client);
+        return;
+    }
+    udp->next_hello = now + UDP_HELLO_INTERVAL;
+    net_send_datagram(client, &(packet_t){.id=UDP_HELLO});
+}
+
+// Sends our token on a fresh connection and waits for the verdict, < 0 if
+// the server could not be reached or did not answer
+static int net_resume_try(game_client_t *client, server_resume_t *reply) {
+    packet_t packet = {.id=CLIENT_RESUME, .packet.client.resume={.token=client->token, .received=client->received}};
+    struct timeval wait = {.tv_sec=RESUME_REPLY_WAIT, .tv_usec=0};
+    fd_set set;
+
+    if ((client->socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+    FD_ZERO(&set);
+    FD_SET(client->socket, &set);
+    if (connect(client->socket, (struct sockaddr *)&client->server, sizeof(client->server)) < 0
+        || send(client->socket, &packet, sizeof(packet), MSG_NOSIGNAL) != sizeof(packet)
+        || select(client->socket + 1, &set, NULL, NULL, &wait) <= 0
+        || recv(client->socket, &packet, sizeof(packet), MSG_WAITALL) != sizeof(packet) || packet.id != SERVER_RESUME) {
+        close(client->socket);
+        client->socket = -1;
+        return -1;
+    }
+    *reply = packet.packet.server.resume;
+    return 0;
+}
+
+// The connection broke: reattach to our seat while the server holds it, the
+// packets we missed follow the reply. 0 when resumed, 1 when the seat was
+// gone and we joined again, < 0 when the server stayed out of reach
+int net_resume(game_client_t *client) {
+    static const struct timespec RETRY = {.tv_sec=0, .tv_nsec=RESUME_RETRY};
+    int64_t until = clock_now_ns() + RESUME_WINDOW;
+    server_resume_t reply;
+
+    if (client->token == 0)
+        return -1;
+    close(client->socket);
+    client->status = BROKEN;
+    fprintf(stderr, "[INFO] Connection lost, resuming session\n");
+    mvprintw(0, 0, "Connection lost, reconnecting...");
+    refresh();
+    while (net_resume_try(client, &reply) < 0) {
+        if (!client->running || clock_now_ns() >= until)
+            return -1;
+        nanosleep(&RETRY, NULL);
+    }
     client->status = STABLE;
+    client->render.dirty = DIRTY_ALL;
+    client->filled = 0;
+    client->streams++;
+    if (reply.accepted) {
+        fprintf(stderr, "[INFO] Session resumed, %u packets replayed\n", reply.replayed);
+        return 0;
+    }
+    fprintf(stderr, "[INFO] Session expired, joining again\n");
+    game_client_rejoin(client);
+    return send(client->socket, &client->join, sizeof(packet_t), MSG_NOSIGNAL) == sizeof(packet_t) ? 1 : -1;
 }
 
 void net_send_packet(game_client_t *client, const packet_t *packet) {
-    if (write(client->socket, packet, sizeof(packet_t)) < 0) {
+    int resumed;
+
+    if (send(client->socket, packet, sizeof(packet_t), MSG_NOSIGNAL) < 0) {
         perror("write");
-        client->status = BROKEN;
-        close(client->socket);
-        exit(EXIT_FAILURE);
+        // Sent again on a resumed connection, pointless after joining anew
+        if ((resumed = net_resume(client)) < 0
+            || (resumed == 0 && send(client->socket, packet, sizeof(packet_t), MSG_NOSIGNAL) < 0)) {
+            client->status = BROKEN;
+            close(client->socket);
+            exit(EXIT_FAILURE);
+        }
     }
 }
 
 net_status_t net_game_read(game_client_t *client) {
-    static packet_t packet;
+    static char buffer[NET_READ_SIZE];
+    const char *data = buffer;
+    int socket = client->socket;
+    unsigned stream = client->streams;
+    packet_t packet;
     ssize_t size;
+    size_t chunk;
 
-    if ((size = read(client->socket, &packet, sizeof(packet_t))) != sizeof(packet_t)) {
-        if (size == 0) {
-            fprintf(stderr, "[INFO] Connection closed on socket: %d\n", client->socket);
-            return CLOSING;
+    if ((size = read(socket, buffer, NET_READ_SIZE)) == 0) {
+        fprintf(stderr, "[INFO] Connection closed on socket: %d\n", socket);
+        return CLOSING;
+    }
+    if (size < 0) {
+        fprintf(stderr, "[ERROR] Could not read socket: %d\n", socket);
+        return BROKEN;
+    }
+    // Stops if a handler had to resume: the rest belonged to the old stream
+    while (size > 0 && client->streams == stream) {
+        chunk = sizeof(packet_t) - client->filled;
+        if (chunk > (size_t)size)
+            chunk = size;
+        memcpy(client->pending + client->filled, data, chunk);
+        client->filled += chunk;
+        data += chunk;
+        size -= chunk;
+        if (client->filled < sizeof(packet_t))
+            break;
+        client->filled = 0;
+        memcpy(&packet, client->pending, sizeof(packet_t));
+        // What the server would replay to a resumed session
+        if (packet_replayed(packet.id))
+            client->received++;
+        game_handle_packet(client, socket, &packet);
+    }
+    return STABLE;
+}
+
+void net_udp_read(game_client_t *client) {
+    datagram_t datagram;
+    ssize_t size;
+
+    while ((size = recv(client->udp.socket, &datagram, sizeof(datagram), MSG_DONTWAIT)) >= 0 || errno == EINTR) {
+        if (size != sizeof(datagram) || datagram.token != client->udp.token)
+            continue;
+        client->udp.received++;
+        if (datagram.packet.id == UDP_HELLO) {
+            client->udp.ready = 1;
+            continue;
         }
-        if (size < 0) {
-            fprintf(stderr, "[ERROR] Could not read socket: %d\n", client->socket);
-            return BROKEN;
+        if (client->game_status.state != RUNNING
+            || (datagram.packet.id != SERVER_PLAYER_UPDATE && datagram.packet.id != SERVER_PROGRESS)) {
+            client->udp.stale++;
+            continue;
         }
-        fprintf(stderr, "[INFO] Invalid packet size (%ld) on socket: %d\n", size, client->socket);
-    } else
-        game_handle_packet(client, client->socket, &packet);
-    return STABLE;
+        if (datagram.packet.id == SERVER_PROGRESS) {
+            progress_apply(client, &datagram.packet.packet.server.progress, datagram.seq);
+            continue;
+        }
+        for (int i = 0; i < client->player_count; i++) {
+            scorboard_t *score = client->scores + i;
+
+            if (score->player_id != datagram.packet.packet.server.player_update.player_id)
+                continue;
+            if (score->seq != 0 && datagram_stale(datagram.seq, score->seq))
+                client->udp.stale++;
+            else {
+                score->seq = datagram.seq;
+                game_handle_packet(client, client->udp.socket, &datagram.packet);
+            }
+            break;
+        }
+    }
 }
 
 void net_loop(game_client_t *client) {
-    static const struct timespec SELECT_TO = {.tv_sec=0, .tv_nsec=50000000};
+    struct timespec SELECT_TO = render_timeout(&client->render);
     static sigset_t SIGSET;
 
     sigemptyset(&SIGSET);
@@ -108,53 +503,115 @@ void net_loop(game_client_t *client) {
 
     FD_ZERO(&client->set);
     FD_SET(client->socket, &client->set);
+    FD_SET(STDIN_FILENO, &client->set);
+    if (client->udp.socket != -1)
+        FD_SET(client->udp.socket, &client->set);
 
-    if (pselect(client->socket + 1, &client->set, NULL, NULL, &SELECT_TO, &SIGSET) < 0) {
+    if (pselect((client->udp.socket > client->socket ? client->udp.socket : client->socket) + 1,
+        &client->set, NULL, NULL, &SELECT_TO, &SIGSET) < 0) {
         perror("select()");
         game_client_destroy(client);
         exit(EXIT_FAILURE);
     }
-    if (FD_ISSET(client->socket, &client->set) && (client->status = net_game_read(client)) != STABLE) {
+    if (FD_ISSET(client->socket, &client->set) && (client->status = net_game_read(client)) != STABLE
+        && net_resume(client) < 0) {
         game_client_destroy(client);
         exit(EXIT_FAILURE);
     }
+    if (client->udp.socket != -1 && FD_ISSET(client->udp.socket, &client->set))
+        net_udp_read(client);
+    net_udp_hello(client, clock_now_ns());
+    if (FD_ISSET(STDIN_FILENO, &client->set))
+        input_drain(client);
 }
 
 
 
 /////////// CLIENT ////////////
 
-void game_client_init(game_client_t *client, const char *host, int port, const char *name) {
-    packet_t join_packet = {.id=CLIENT_PLAYER_INFOS, .packet.client.player_infos={.start_words=MAX_START_WORDS}};
+void game_client_init(game_client_t *client, const char *host, int port, const char *name, int udp, int progress, int analytics) {
+    packet_t join_packet = {.id=CLIENT_PLAYER_INFOS, .packet.client.player_infos={
+        .start_words=MAX_START_WORDS,
+        .udp=udp,
+        .progress=progress
+    }};
 
+    client->token = 0;
+    client->received = 0;
+    client->filled = 0;
+    client->streams = 0;
+    client->running = 1;
     client->player_count = 0;
-    client->words = 0;
+    client->ranked = 0;
+    client->lookahead = join_packet.packet.client.player_infos.start_words;
+    word_ring_init(&client->words, client->lookahead);
+    client->cursor = 0;
+    client->input = (input_stats_t){0};
+    client->race_keys = 0;
+    client->race_errors = 0;
+    client->word_started = 0;
+    client->leaderboard = (leaderboard_t){0};
+    analytics_init(&client->analytics, analytics);
+    client->render = (render_t){0};
+    client->udp = (udp_channel_t){.socket=-1};
+    client->progress = (progress_t){.enabled=progress};
+#ifdef DEBUG
+    client->overlay = 1;
+#else
+    client->overlay = 0;
+#endif
     client->game_status.time_remain = -1;
+    client->game_status.deadline = 0;
     client->game_status.state = WAITTING;
     strncpy(join_packet.packet.client.player_infos.name, name, MAX_PLAYER_NAME_SIZE);
     strncpy(client->scores[0].name, name, MAX_PLAYER_NAME_SIZE);
+    client->join = join_packet;
     net_init(client, host, port);
     net_send_packet(client, &join_packet);
 }
 
+// Our seat is gone: forget the room, the server introduces it again
+void game_client_rejoin(game_client_t *client) {
+    client->token = 0;
+    client->received = 0;
+    client->player_count = 0;
+    client->ranked = 0;
+    client->cursor = 0;
+    word_ring_clear(&client->words);
+    client->game_status.time_remain = -1;
+    client->game_status.deadline = 0;
+    client->game_status.state = WAITTING;
+    client->race_keys = 0;
+    client->race_errors = 0;
+    client->word_started = 0;
+}
+
 void game_client_destroy(game_client_t *client) {
     if (client->status == STABLE)
         net_send_packet(client, &(packet_t){.id=CLIENT_DISCONNECT, .packet.client.player_leave={"Client disconnect"}});
     close(client->socket);
+    net_udp_close(client);
     endwin();
+    word_ring_destroy(&client->words);
+    analytics_destroy(&client->analytics);
     client->status = CLOSED;
 }
 
-void init_ncurse_win()
+void init_ncurse_win(render_t *render)
 {
     initscr();
     start_color();
     noecho();
     curs_set(0);
-    timeout(100);
+    nodelay(stdscr, TRUE);
+    keypad(stdscr, TRUE);
     init_pair(1, COLOR_GREEN, COLOR_BLACK);
     init_pair(2, COLOR_WHITE, COLOR_BLACK);
     init_pair(3, COLOR_WHITE, COLOR_BLUE);
+    render->dirty = DIRTY_ALL;
+    render->timer = -2;
+    render->window = clock_now_ns();
+    render->window_bytes = terminal_bytes();
 }
 
 int invalid_terminal_size()
@@ -168,86 +625,646 @@ int invalid_terminal_size()
     return 0;
 }
 
+// The server sends an absolute deadline already translated to our clock
+int time_remain(const server_game_status_t *status)
+{
+    int64_t left;
+
+    if (status->deadline == 0)
+        return -1;
+    left = status->deadline - clock_now_ns();
+    return left > 0 ? (left + 999999999) / 1000000000 : 0;
+}
+
 void timer(int time)
 {
     if (time < 0)
         mvprintw(0, COLS - 7, "PAUSED");
     else
-        mvprintw(0, COLS - 5, "%- .3ds", time);
+        mvprintw(0, COLS - 7, "%6ds", time);
 }
 
-void scorboard(scorboard_t *players, int player_count)
+// With progress streaming, characters into the current word follow the score
+void scorboard(scorboard_t *players, int player_count, int progress)
 {
-    for (int i = 0; i < player_count; i++) {
-        mvprintw(i + 2, COLS - MAX_PLAYER_NAME_SIZE - 4, "%.*s ", MAX_PLAYER_NAME_SIZE, players[i].name);
-        mvprintw(i + 2, COLS - 4, "%.4d", players[i].score);
+    int width = progress ? 7 : 4;
+
+    for (int i = 0; i < MAX_PLAYER; i++) {
+        move(i + 2, COLS - MAX_PLAYER_NAME_SIZE - width - 3);
+        clrtoeol();
+        if (i >= player_count)
+            continue;
+        if (players[i].place > 0)
+            printw("%d. ", players[i].place);
+        mvprintw(i + 2, COLS - MAX_PLAYER_NAME_SIZE - width, "%.*s ", MAX_PLAYER_NAME_SIZE, players[i].name);
+        mvprintw(i + 2, COLS - width, "%.4d", players[i].score);
+        if (progress && players[i].chars > 0 && players[i].progress_word == players[i].score)
+            printw("+%-2d", players[i].chars);
     }
 }
 
-void writing_screen(game_client_t *game, int *pos)
+void writing_screen(game_client_t *game, int pos)
 {
-    char word[MAX_STRING_SIZE];
-    char c = 0;
+    const char *word;
+    int len;
 
-    if (!game->words) {
-        return;
-    }
-    strncpy(word, game->words->word, MAX_STRING_SIZE);
     move(1, 1);
+    clrtoeol();
+    if (game->game_status.state != RUNNING || (word = word_ring_peek(&game->words)) == NULL)
+        return;
+    len = strnlen(word, MAX_STRING_SIZE);
     attron(COLOR_PAIR(1));
-    for (int i = 0; i < *pos; i++) {
-        printw("%c", word[i]);
-    }
+    addnstr(word, pos);
     attroff(COLOR_PAIR(1));
+    if (pos >= len)
+        return;
     attron(COLOR_PAIR(3));
-    printw("%c", word[*pos]);
+    addch(word[pos]);
     attroff(COLOR_PAIR(3));
     attron(COLOR_PAIR(2));
-    for (int i = *pos + 1; i < 10; i++) {
-        printw("%c", word[i]);
-    }
+    addnstr(word + pos + 1, len - pos - 1);
     attroff(COLOR_PAIR(2));
-    refresh();
-    c = getch();
-    if (c == word[*pos]) {
-        (*pos)++;
+}
+
+void waiting_screen(int waiting)
+{
+    move(0, 0);
+    if (waiting)
+        printw("Waiting for players...");
+    else
+        clrtoeol();
+}
+
+// Left of the scoreboard: live speed during a race, the summary after it
+void stats_panel(const game_client_t *client)
+{
+    const analytics_t *stats = &client->analytics;
+    const client_typing_summary_t *summary = &stats->summary;
+    int width = COLS - MAX_PLAYER_NAME_SIZE - 11;
+    char lines[3][128] = {"", "", ""};
+    int len;
+
+    if (client->game_status.state == RUNNING)
+        snprintf(lines[0], sizeof(lines[0]), "%u.%02u wpm %u.%02u%%", stats->wpm / 100, stats->wpm % 100,
+            stats->keys > 0 ? stats->correct * 10000 / stats->keys / 100 : 0,
+            stats->keys > 0 ? stats->correct * 10000 / stats->keys % 100 : 0);
+    else if (stats->summarized) {
+        snprintf(lines[0], sizeof(lines[0]), "Last race %u.%02u wpm (peak %u.%02u) %u.%02u%%",
+            summary->wpm / 100, summary->wpm % 100, summary->peak_wpm / 100, summary->peak_wpm % 100,
+            summary->accuracy / 100, summary->accuracy % 100);
+        len = snprintf(lines[1], sizeof(lines[1]), "Keys p50 %u ms p90 %u ms", summary->bigram_p50, summary->bigram_p90);
+        if (summary->slowest_bigram_ms > 0)
+            snprintf(lines[1] + len, sizeof(lines[1]) - len, ", slowest '%.2s' %u ms",
+                summary->slowest_bigram, summary->slowest_bigram_ms);
+        len = snprintf(lines[2], sizeof(lines[2]), "3 keys p50 %u ms", summary->trigram_p50);
+        if (summary->slowest_trigram_ms > 0)
+            snprintf(lines[2] + len, sizeof(lines[2]) - len, ", slowest '%.3s' %u ms",
+                summary->slowest_trigram, summary->slowest_trigram_ms);
     }
-    if (*pos == MAX_STRING_SIZE || word[*pos] == 0) {
-        net_send_packet(game, &(packet_t){.id=CLIENT_WORD_COMPLETE});
-        word_list_t *tmp = game->words;
-        game->words = game->words->next;
-        free(tmp);
-        (*pos) = 0;
+    for (int i = 0; i < 3; i++)
+        mvprintw(i + 2, 0, "%-*.*s", width, width, lines[i]);
+}
+
+// Best players, then our own rank if we are not among them
+void leaderboard_panel(const leaderboard_t *board)
+{
+    int line = MAX_PLAYER + 3;
+
+    for (int i = line; i < LINES - 1; i++) {
+        move(i, 0);
+        clrtoeol();
+    }
+    if (!board->shown || line >= LINES - 1)
+        return;
+    mvprintw(line++, 0, "Leaderboard (%u players)", board->count > 0 ? board->rows[0].total : 0);
+    for (int i = 0; i < board->count && line < LINES - 1; i++) {
+        const server_leaderboard_t *row = board->rows + i;
+
+        if (i > 0 && row->rank <= board->rows[i - 1].rank)
+            continue;
+        mvprintw(line++, 0, "%4d. %-*.*s %4u.%02u wpm %3u.%02u%% %5u races", row->rank,
+            MAX_PLAYER_NAME_SIZE, MAX_PLAYER_NAME_SIZE, row->name,
+            row->wpm / 100, row->wpm % 100, row->accuracy / 100, row->accuracy % 100, row->races);
     }
 }
 
-void waiting_screen()
+void debug_overlay(const game_client_t *client)
 {
-    mvprintw(0, 0, "Waiting for players...");
-    refresh();
+    const input_stats_t *input = &client->input;
+
+    move(LINES - 1, 0);
+    clrtoeol();
+    if (!client->overlay)
+        return;
+    printw("keys %lu | last %ld us | avg %ld us | max %ld us | %lu frames | %lu B/s | udp %s %lu/%lu stale",
+        input->keys, input->last / 1000, input->avg / 1000, input->max / 1000,
+        client->render.frames, client->render.rate,
+        client->udp.ready ? "on" : "off", client->udp.stale, client->udp.received);
 }
 
-void game_client_start(game_client_t *client)
+
+
+/////////// RENDER ////////////
+
+// ncurses writes straight to the tty fd, so terminal traffic is taken from
+// the kernel's per-process write accounting. Sockets only see send() and
+// recv(), which it leaves out.
+uint64_t terminal_bytes(void)
+{
+    static const char TAG[] = "wchar: ";
+    char buffer[256];
+    char *pch;
+    int fd = open("/proc/self/io", O_RDONLY);
+    ssize_t size;
+
+    if (fd < 0)
+        return 0;
+    size = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (size <= 0)
+        return 0;
+    buffer[size] = 0;
+    if ((pch = strstr(buffer, TAG)) == NULL)
+        return 0;
+    return strtoull(pch + sizeof(TAG) - 1, NULL, 10);
+}
+
+// Redraws only the damaged regions, at most RENDER_FPS times per second, and
+// flushes them to the terminal with a single doupdate. Returns 1 if a frame
+// was emitted.
+int render_frame(game_client_t *client)
 {
-    int cursor_pos = 0;
+    render_t *render = &client->render;
+    int64_t now = clock_now_ns();
+    int remain = time_remain(&client->game_status);
 
-    init_ncurse_win();
+    if (remain != render->timer)
+        render->dirty |= DIRTY_TIMER;
+    if (now - render->window >= 1000000000) {
+        uint64_t bytes = terminal_bytes();
+
+        // The counter is the kernel's, a window that went backwards is idle
+        render->rate = bytes > render->window_bytes ? (bytes - render->window_bytes) * 1000000000 / (now - render->window) : 0;
+        render->window_bytes = bytes;
+        render->window = now;
+        if (client->overlay)
+            render->dirty |= DIRTY_OVERLAY;
+    }
+    if (render->dirty == 0 || now < render->next_frame)
+        return 0;
+    if (render->dirty == DIRTY_ALL) {
+        erase();
+        if (invalid_terminal_size())
+            return 0;
+    }
+    if (render->dirty & DIRTY_TIMER) {
+        timer(remain);
+        render->timer = remain;
+    }
+    if (render->dirty & DIRTY_STATUS)
+        waiting_screen(client->game_status.state != RUNNING);
+    if (render->dirty & DIRTY_STATS)
+        stats_panel(client);
+    if (render->dirty & DIRTY_SCORES)
+        scorboard(client->scores, client->player_count, client->progress.enabled);
+    if (render->dirty & DIRTY_WORD)
+        writing_screen(client, client->cursor);
+    if (render->dirty & DIRTY_BOARD)
+        leaderboard_panel(&client->leaderboard);
+    if (render->dirty & DIRTY_OVERLAY)
+        debug_overlay(client);
+    wnoutrefresh(stdscr);
+    doupdate();
+    render->dirty = 0;
+    render->frames++;
+    render->next_frame = now + 1000000000 / RENDER_FPS;
+    return 1;
+}
+
+// How long the event loop may sleep before the next frame is due
+struct timespec render_timeout(const render_t *render)
+{
+    int64_t wait = 50000000;
+
+    if (render->dirty != 0) {
+        wait = render->next_frame - clock_now_ns();
+        if (wait < 0)
+            wait = 0;
+    }
+    return (struct timespec){.tv_sec=0, .tv_nsec=wait};
+}
+
+void game_client_start(game_client_t *client)
+{
+    init_ncurse_win(&client->render);
     client->running = 1;
     while (client->running)
     {
         net_loop(client);
-        clear();
-        if (invalid_terminal_size())
+        if (render_frame(client)) {
+            input_record(client);
+            progress_report(client);
+        }
+    }
+}
+
+
+
+/////////// PROGRESS ////////////
+
+// Keystrokes of a frame are folded into a single report, sent only if the
+// position moved since the previous one
+void progress_report(game_client_t *client)
+{
+    progress_t *progress = &client->progress;
+    packet_t packet = {.id=CLIENT_PROGRESS, .packet.client.progress={.word=progress->word, .chars=client->cursor}};
+
+    if (!progress->enabled || client->game_status.state != RUNNING
+        || (progress->sent_word == progress->word && progress->sent_chars == client->cursor))
+        return;
+    progress->sent_word = progress->word;
+    progress->sent_chars = client->cursor;
+    if (client->udp.ready)
+        net_send_datagram(client, &packet);
+    else
+        net_send_packet(client, &packet);
+}
+
+// seq is 0 for packets from the stream, which are never stale
+void progress_apply(game_client_t *client, const server_progress_t *progress, uint32_t seq)
+{
+    int player_id, word, chars;
+
+    for (int i = 0; i < progress->count && i < MAX_PROGRESS_ENTRIES; i++) {
+        progress_entry_read(progress, i, &player_id, &word, &chars);
+        for (int j = 0; j < client->player_count; j++) {
+            scorboard_t *score = client->scores + j;
+
+            if ((score->player_id & ((1 << PROGRESS_ID_BITS) - 1)) != player_id
+                || score->player_id == client->info.player_id)
+                continue;
+            if (seq != 0 && score->progress_seq != 0 && datagram_stale(seq, score->progress_seq))
+                client->udp.stale++;
+            else {
+                if (seq != 0)
+                    score->progress_seq = seq;
+                score->chars = chars;
+                score->progress_word = word;
+                client->render.dirty |= DIRTY_SCORES;
+            }
+            break;
+        }
+    }
+}
+
+void progress_local(game_client_t *client)
+{
+    for (int i = 0; i < client->player_count; i++) {
+        if (client->scores[i].player_id != client->info.player_id)
+            continue;
+        client->scores[i].chars = client->cursor;
+        client->scores[i].progress_word = client->scores[i].score;
+        client->render.dirty |= DIRTY_SCORES;
+    }
+}
+
+
+
+/////////// ANALYTICS ////////////
+
+void analytics_init(analytics_t *stats, int upload)
+{
+    *stats = (analytics_t){.upload=upload};
+    stats->events = calloc(ANALYTICS_EVENTS, sizeof(keystroke_t));
+    stats->bigrams = calloc(NGRAM_CHARS * NGRAM_CHARS, sizeof(ngram_stat_t));
+    stats->trigrams = calloc(TRIGRAM_SLOTS, sizeof(ngram_stat_t));
+    if (stats->events == NULL || stats->bigrams == NULL || stats->trigrams == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void analytics_destroy(analytics_t *stats)
+{
+    free(stats->events);
+    free(stats->bigrams);
+    free(stats->trigrams);
+}
+
+// Tables are cleared between races, never during one
+void analytics_start(analytics_t *stats)
+{
+    stats->keys = 0;
+    stats->correct = 0;
+    stats->window = 0;
+    stats->window_correct = 0;
+    stats->wpm = 0;
+    stats->peak_wpm = 0;
+    stats->chain = 0;
+    memset(stats->bigrams, 0, NGRAM_CHARS * NGRAM_CHARS * sizeof(ngram_stat_t));
+    memset(stats->trigrams, 0, TRIGRAM_SLOTS * sizeof(ngram_stat_t));
+    stats->bigram_hist = (latency_hist_t){0};
+    stats->trigram_hist = (latency_hist_t){0};
+}
+
+static void latency_record(latency_hist_t *hist, int64_t latency)
+{
+    int64_t bucket = latency / (NGRAM_BUCKET_MS * 1000000);
+
+    hist->buckets[bucket < NGRAM_BUCKETS - 1 ? bucket : NGRAM_BUCKETS - 1]++;
+    hist->count++;
+}
+
+// Upper bound of the bucket holding the percentile, in ms
+static uint16_t latency_percentile(const latency_hist_t *hist, int percent)
+{
+    uint64_t rank = ((uint64_t)hist->count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < NGRAM_BUCKETS && hist->count > 0; i++)
+        if ((seen += hist->buckets[i]) >= rank)
+            return (i + 1) * NGRAM_BUCKET_MS;
+    return 0;
+}
+
+// 5 characters a word, in hundredths of a word per minute
+static uint32_t analytics_wpm(uint64_t chars, int64_t span)
+{
+    return chars * 1200000000000ull / (span > 1000000000 ? span : 1000000000);
+}
+
+static ngram_stat_t *trigram_slot(analytics_t *stats, const char key[3])
+{
+    uint32_t hash = ((uint8_t)key[0] * 31u + (uint8_t)key[1]) * 31u + (uint8_t)key[2];
+    ngram_stat_t *slot;
+
+    for (uint32_t i = 0; i < TRIGRAM_SLOTS; i++) {
+        slot = stats->trigrams + ((hash + i) & (TRIGRAM_SLOTS - 1));
+        if (slot->count == 0)
+            memcpy(slot->key, key, 3);
+        if (memcmp(slot->key, key, 3) == 0)
+            return slot;
+    }
+    return NULL;
+}
+
+static inline int ngram_char(char key)
+{
+    return key >= NGRAM_FIRST && key < NGRAM_FIRST + NGRAM_CHARS;
+}
+
+// Constant work per key: the input path never waits on the analytics
+void analytics_key(analytics_t *stats, char key, int correct, int64_t now)
+{
+    keystroke_t *event;
+    ngram_stat_t *ngram;
+
+    if (stats->keys == 0)
+        stats->started = now;
+    while (stats->window != stats->keys && (stats->keys - stats->window >= ANALYTICS_EVENTS
+        || stats->events[stats->window % ANALYTICS_EVENTS].t <= now - ANALYTICS_WINDOW))
+        stats->window_correct -= stats->events[stats->window++ % ANALYTICS_EVENTS].correct;
+    event = stats->events + stats->keys++ % ANALYTICS_EVENTS;
+    *event = (keystroke_t){.t=now, .key=key, .correct=correct != 0};
+    stats->correct += event->correct;
+    stats->window_correct += event->correct;
+    if (now - stats->started < ANALYTICS_WINDOW)
+        stats->wpm = analytics_wpm(stats->window_correct, now - stats->started);
+    else if ((stats->wpm = analytics_wpm(stats->window_correct, ANALYTICS_WINDOW)) > stats->peak_wpm)
+        stats->peak_wpm = stats->wpm;
+
+    // Errors and pauses break the chain: what follows them is no typing rhythm
+    if (!correct || !ngram_char(key) || (stats->chain > 0 && now - stats->recent_t[1] > ANALYTICS_IDLE)) {
+        stats->chain = 0;
+        if (!correct || !ngram_char(key))
+            return;
+    }
+    if (stats->chain >= 1) {
+        ngram = stats->bigrams + (stats->recent[1] - NGRAM_FIRST) * NGRAM_CHARS + key - NGRAM_FIRST;
+        ngram->count++;
+        ngram->total_us += (now - stats->recent_t[1]) / 1000;
+        latency_record(&stats->bigram_hist, now - stats->recent_t[1]);
+    }
+    if (stats->chain >= 2 && (ngram = trigram_slot(stats, (char[3]){stats->recent[0], stats->recent[1], key})) != NULL) {
+        ngram->count++;
+        ngram->total_us += (now - stats->recent_t[0]) / 1000;
+        latency_record(&stats->trigram_hist, now - stats->recent_t[0]);
+    }
+    stats->recent[0] = stats->recent[1];
+    stats->recent_t[0] = stats->recent_t[1];
+    stats->recent[1] = key;
+    stats->recent_t[1] = now;
+    if (stats->chain < 2)
+        stats->chain++;
+}
+
+// The next word starts a new chain
+void analytics_word_end(analytics_t *stats)
+{
+    stats->chain = 0;
+}
+
+// Slowest n-gram on average among those typed often enough, its mean in ms
+static uint16_t ngram_slowest(const ngram_stat_t *ngrams, int count, int *index)
+{
+    uint64_t worst = 0;
+
+    *index = -1;
+    for (int i = 0; i < count; i++)
+        if (ngrams[i].count >= NGRAM_MIN_COUNT && ngrams[i].total_us / ngrams[i].count > worst) {
+            worst = ngrams[i].total_us / ngrams[i].count;
+            *index = i;
+        }
+    return worst / 1000 < UINT16_MAX ? worst / 1000 : UINT16_MAX;
+}
+
+// Race over: summarized once, shown until the next one and sent if asked to
+void analytics_finish(game_client_t *client)
+{
+    analytics_t *stats = &client->analytics;
+    client_typing_summary_t *summary = &stats->summary;
+    int64_t span;
+    int slowest;
+
+    if (stats->keys == 0)
+        return;
+    span = stats->events[(stats->keys - 1) % ANALYTICS_EVENTS].t - stats->started;
+    *summary = (client_typing_summary_t){
+        .wpm=analytics_wpm(stats->correct, span),
+        .peak_wpm=stats->peak_wpm,
+        .accuracy=(uint64_t)stats->correct * 10000 / stats->keys,
+        .bigram_p50=latency_percentile(&stats->bigram_hist, 50),
+        .bigram_p90=latency_percentile(&stats->bigram_hist, 90),
+        .trigram_p50=latency_percentile(&stats->trigram_hist, 50)
+    };
+    // Races shorter than the window have a single speed
+    if (summary->peak_wpm < summary->wpm)
+        summary->peak_wpm = summary->wpm;
+    summary->slowest_bigram_ms = ngram_slowest(stats->bigrams, NGRAM_CHARS * NGRAM_CHARS, &slowest);
+    if (slowest >= 0) {
+        summary->slowest_bigram[0] = NGRAM_FIRST + slowest / NGRAM_CHARS;
+        summary->slowest_bigram[1] = NGRAM_FIRST + slowest % NGRAM_CHARS;
+    }
+    summary->slowest_trigram_ms = ngram_slowest(stats->trigrams, TRIGRAM_SLOTS, &slowest);
+    if (slowest >= 0)
+        memcpy(summary->slowest_trigram, stats->trigrams[slowest].key, 3);
+    stats->summarized = 1;
+    client->render.dirty |= DIRTY_STATS;
+    if (stats->upload)
+        net_send_packet(client, &(packet_t){.id=CLIENT_TYPING_SUMMARY, .packet.client.typing_summary=*summary});
+}
+
+
+
+/////////// INPUT ////////////
+
+void input_handle_key(game_client_t *client, int c)
+{
+    const char *word;
+    int64_t now;
+
+    if (c == OVERLAY_KEY) {
+        client->overlay = !client->overlay;
+        client->render.dirty |= DIRTY_OVERLAY;
+        return;
+    }
+    if (c == LEADERBOARD_KEY) {
+        client->leaderboard.shown = !client->leaderboard.shown;
+        client->render.dirty |= DIRTY_BOARD;
+        if (client->leaderboard.shown)
+            net_send_packet(client, &(packet_t){.id=CLIENT_LEADERBOARD, .packet.client.leaderboard={.count=LEADERBOARD_ROWS}});
+        return;
+    }
+    if (c == KEY_RESIZE) {
+        client->render.dirty = DIRTY_ALL;
+        return;
+    }
+    if (client->game_status.state != RUNNING || (word = word_ring_peek(&client->words)) == NULL)
+        return;
+    now = clock_now_ns();
+    client->race_keys++;
+    if (client->word_started == 0)
+        client->word_started = now;
+    analytics_key(&client->analytics, c, c == word[client->cursor], now);
+    client->render.dirty |= DIRTY_STATS;
+    if (c == word[client->cursor]) {
+        client->cursor++;
+        client->render.dirty |= DIRTY_WORD;
+    } else
+        client->race_errors++;
+    if (client->cursor == MAX_STRING_SIZE || word[client->cursor] == 0) {
+        analytics_word_end(&client->analytics);
+        net_send_packet(client, &(packet_t){.id=CLIENT_WORD_COMPLETE, .packet.client.word_complete={
+            .keys=client->race_keys,
+            .errors=client->race_errors,
+            .hash=packet_word_hash(word),
+            .typing_ms=(now - client->word_started) / 1000000
+        }});
+        word_ring_pop(&client->words);
+        client->cursor = 0;
+        client->word_started = 0;
+        client->progress.word++;
+        client->render.dirty |= DIRTY_WORD;
+    }
+    if (client->progress.enabled)
+        progress_local(client);
+}
+
+// Everything buffered since the last wakeup is consumed in one go. The wait
+// starts with the first key of a frame: a frame held back by RENDER_FPS
+// keeps it across later wakeups.
+void input_drain(game_client_t *client)
+{
+    int c;
+
+    while ((c = getch()) != ERR) {
+        if (client->input.pending == 0)
+            client->input.woke = clock_now_ns();
+        input_handle_key(client, c);
+        client->input.pending++;
+    }
+    // Keys that left the screen as it was have no frame to wait for
+    if (client->render.dirty == 0) {
+        client->input.keys += client->input.pending;
+        client->input.pending = 0;
+    }
+}
+
+// Called once the frame holding the drained keystrokes has been flushed
+void input_record(game_client_t *client)
+{
+    input_stats_t *input = &client->input;
+    int64_t latency;
+
+    if (input->pending == 0)
+        return;
+    latency = clock_now_ns() - input->woke;
+    client->render.dirty |= DIRTY_OVERLAY;
+    input->keys += input->pending;
+    input->pending = 0;
+    input->last = latency;
+    input->avg = input->avg == 0 ? latency : input->avg + (latency - input->avg) / 8;
+    if (latency > input->max)
+        input->max = latency;
+}
+
+
+void leaderboard_apply(leaderboard_t *board, const server_leaderboard_t *row)
+{
+    if (row->rank != 0) {
+        if (board->filling < MAX_LEADERBOARD_ROWS + 1)
+            board->pending[board->filling++] = *row;
+        return;
+    }
+    memcpy(board->rows, board->pending, board->filling * sizeof(server_leaderboard_t));
+    board->count = board->filling;
+    board->filling = 0;
+}
+
+// Same move as the server's: the racer lands on its place and the ones it
+// passed slide down
+void standings_move(game_client_t *client, int player_id, int place)
+{
+    int from = client->ranked;
+
+    for (int i = 0; i < client->ranked; i++)
+        if (client->standings[i] == player_id)
+            from = i;
+    if (place < 1 || place > client->ranked + (from == client->ranked) || (from == client->ranked && from == MAX_PLAYER))
+        return;
+    if (from == client->ranked)
+        client->ranked++;
+    place--;
+    if (place < from)
+        memmove(client->standings + place + 1, client->standings + place, (from - place) * sizeof(int));
+    else
+        memmove(client->standings + from, client->standings + from + 1, (place - from) * sizeof(int));
+    client->standings[place] = player_id;
+    standings_show(client);
+}
+
+void standings_drop(game_client_t *client, int player_id)
+{
+    for (int i = 0; i < client->ranked; i++) {
+        if (client->standings[i] != player_id)
             continue;
-        timer(client->game_status.time_remain);
-        scorboard(client->scores, client->player_count);
-        if (client->game_status.state == RUNNING)
-            writing_screen(client, &cursor_pos);
-        else
-            waiting_screen();
+        client->ranked--;
+        memmove(client->standings + i, client->standings + i + 1, (client->ranked - i) * sizeof(int));
+        break;
     }
+    standings_show(client);
 }
 
+void standings_show(game_client_t *client)
+{
+    for (int i = 0; i < client->player_count; i++) {
+        client->scores[i].place = 0;
+        for (int j = 0; j < client->ranked; j++)
+            if (client->standings[j] == client->scores[i].player_id)
+                client->scores[i].place = j + 1;
+    }
+    client->render.dirty |= DIRTY_SCORES;
+}
 
 void game_handle_packet(game_client_t *game, int socket, const packet_t *packet) {
     // Suppress unused warnings
@@ -258,30 +1275,79 @@ void game_handle_packet(game_client_t *game, int socket, const packet_t *packet)
     switch (packet->id)
     {
     case SERVER_GAME_STATUS:
+        game->render.dirty |= DIRTY_TIMER;
         if (packet->packet.server.game_status.state != game->game_status.state) {
+            game->render.dirty = DIRTY_ALL;
             if (packet->packet.server.game_status.state == WAITTING) {
-                while (game->words) {
-                    word_list_t *list = game->words;
-                    game->words = game->words->next;
-                    free(list);
-                }
+                game->cursor = 0;
+                word_ring_clear(&game->words);
             }
+            // Datagram sequences restart their comparison every race
+            for (int i = 0; i < game->player_count; i++) {
+                game->scores[i].seq = 0;
+                game->scores[i].progress_seq = 0;
+                game->scores[i].chars = 0;
+            }
+            game->progress.word = 0;
+            game->progress.sent_word = 0;
+            game->progress.sent_chars = 0;
+            if (game->game_status.state == RUNNING)
+                analytics_finish(game);
+            else if (packet->packet.server.game_status.state == RUNNING)
+                analytics_start(&game->analytics);
+            game->race_keys = 0;
+            game->race_errors = 0;
+            game->word_started = 0;
+            // The new order follows the status of a starting race
+            if (packet->packet.server.game_status.state == RUNNING)
+                game->ranked = 0;
+            // A race just ended: standings may have moved
+            if (game->leaderboard.shown && packet->packet.server.game_status.state == WAITTING)
+                net_send_packet(game, &(packet_t){.id=CLIENT_LEADERBOARD, .packet.client.leaderboard={.count=LEADERBOARD_ROWS}});
         }
         game->game_status = packet->packet.server.game_status;
         break;
+    case SERVER_PING:
+        net_send_packet(game, &(packet_t){.id=CLIENT_PONG, .packet.client.pong={
+            .sent=packet->packet.server.ping.sent,
+            .received=clock_now_ns()
+        }});
+        break;
+    case SERVER_UDP_OFFER:
+        net_udp_open(game, packet->packet.server.udp_offer.token);
+        break;
+    case SERVER_PROGRESS:
+        progress_apply(game, &packet->packet.server.progress, 0);
+        break;
+    case SERVER_PLAYER_PLACE:
+        standings_move(game, packet->packet.server.player_place.player_id, packet->packet.server.player_place.place);
+        break;
+    case SERVER_LEADERBOARD:
+        leaderboard_apply(&game->leaderboard, &packet->packet.server.leaderboard);
+        game->render.dirty |= DIRTY_BOARD;
+        break;
     case SERVER_PLAYER_UPDATE:
         for (int i = 0; i < game->player_count; i++) {
             if (packet->packet.server.player_update.player_id == game->scores[i].player_id) {
                 game->scores[i].score = packet->packet.server.player_update.score;
+                game->render.dirty |= DIRTY_SCORES;
                 break;
             }
         }
         break;
     case SERVER_PLAYER_ACCEPT:
-        game->info = packet->packet.server.player_accept;
+        game->info = packet->packet.server.player_accept.info;
+        game->token = packet->packet.server.player_accept.token;
+        if (game->player_count == MAX_PLAYER)
+            break;
         game->scores[game->player_count].score = game->info.score;
         game->scores[game->player_count].player_id = game->info.player_id;
+        game->scores[game->player_count].seq = 0;
+        game->scores[game->player_count].chars = 0;
+        game->scores[game->player_count].progress_seq = 0;
+        game->scores[game->player_count].place = 0;
         game->player_count++;
+        game->render.dirty |= DIRTY_SCORES;
         break;
     
     case SERVER_PLAYER_REMOVE:
@@ -290,30 +1356,32 @@ void game_handle_packet(game_client_t *game, int socket, const packet_t *packet)
                 game->player_count--;
                 if (i != game->player_count)
                     game->scores[i] = game->scores[game->player_count];
+                game->render.dirty |= DIRTY_SCORES;
             }
         }
+        standings_drop(game, packet->packet.server.player_remove.player_id);
         break;
     case SERVER_PLAYER_JOIN:
         server_player_join_t info = packet->packet.server.player_join;
+        if (game->player_count == MAX_PLAYER) {
+            fprintf(stderr, "[ERROR] Player %d dropped, scoreboard is full\n", info.info.player_id);
+            break;
+        }
         game->scores[game->player_count].score = info.info.score;
         game->scores[game->player_count].player_id = info.info.player_id;
+        game->scores[game->player_count].seq = 0;
+        game->scores[game->player_count].chars = 0;
+        game->scores[game->player_count].progress_seq = 0;
+        game->scores[game->player_count].place = 0;
         strncpy(game->scores[game->player_count].name, info.name, MAX_PLAYER_NAME_SIZE);
         game->player_count++;
+        game->render.dirty |= DIRTY_SCORES;
         break;
     case SERVER_NEW_WORD:
-        word_list_t *node = malloc(sizeof(word_list_t));
-        word_list_t *it = game->words;
-
-        node->next = 0;
-        strncpy(node->word, packet->packet.server.new_word.word, MAX_STRING_SIZE);
-        if (!game->words) {
-            game->words = node;
-            break;
-        }
-        while (it && it->next) {
-            it = it->next;
-        }
-        it->next = node;
+        if (word_ring_push(&game->words, packet->packet.server.new_word.word) < 0)
+            fprintf(stderr, "[ERROR] Word dropped, more than %d words ahead\n", game->lookahead);
+        else if (word_ring_size(&game->words) == 1)
+            game->render.dirty |= DIRTY_WORD;
         break;
     default:
         fprintf(stderr, "[INFO] Invalid packet received: %d\n", packet->id);
@@ -324,11 +1392,6 @@ void game_handle_packet(game_client_t *game, int socket, const packet_t *packet)
 /////////// SIGNAL ////////////
 
 static int *TARGET = NULL;
-static int *REMAIN = NULL;
-static const struct itimerval TIMER = {
-    .it_interval={.tv_sec=1, .tv_usec=0},
-    .it_value={.tv_sec=1, .tv_usec=0}
-};
 
 void signal_handler(int signal) {
     if (TARGET == NULL)
@@ -339,21 +1402,41 @@ void signal_handler(int signal) {
     }
 }
 
-void alarm_handler(int signal) {
-    if (signal == SIGALRM && REMAIN != NULL && *REMAIN > 0) {
-        *REMAIN -= TIMER.it_value.tv_sec;
-    }
-}
-
 
 /////////// MAIN ////////////
 
-static const char USAGE[] = "Usage: ./client [ip] [port] [name]\n";
+static const char USAGE[] = "Usage: ./client [-t] [-p] [-a] [ip] [port] [name]\n";
 
 int main(int argc, char *argv[]) {
     game_client_t client;
+    int udp = 1;
+    int progress = 0;
+    int analytics = 0;
     int port;
+    int opt;
 
+    // -t: TCP only, never ask for the datagram channel
+    // -p: stream character-level progress and show the opponents'
+    // -a: send the typing summary of each race to the server
+    while ((opt = getopt(argc, argv, "tpa")) != -1) {
+        switch (opt)
+        {
+        case 't':
+            udp = 0;
+            break;
+        case 'p':
+            progress = 1;
+            break;
+        case 'a':
+            analytics = 1;
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
     if (argc != 4) {
         fprintf(stderr, USAGE);
         exit(EXIT_FAILURE);
@@ -364,11 +1447,8 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     signal(SIGINT, signal_handler);
-    signal(SIGALRM, alarm_handler);
-    setitimer(ITIMER_REAL, &TIMER, NULL);
-    game_client_init(&client, argv[1], port, argv[3]);
+    game_client_init(&client, argv[1], port, argv[3], udp, progress, analytics);
     TARGET = &client.running;
-    REMAIN = &client.game_status.time_remain;
     game_client_start(&client);
     game_client_destroy(&client);
     return EXIT_SUCCESS;
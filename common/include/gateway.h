@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "packet.h"
+
+// Gateway <-> backend protocol, over the Unix stream socket every backend
+// opens to the gateway. The gateway reads the first packet of a client to
+// route it, then hands the connection itself over (SCM_RIGHTS) along with
+// that packet: game traffic never goes through the gateway.
+
+#define     GATEWAY_MAX_BACKENDS    255
+// Resume tokens carry the id of the backend that issued them in their top
+// byte, so a reconnecting client finds its room again
+#define     GATEWAY_BACKEND_SHIFT   56
+
+typedef enum gateway_msg_type_e {
+    // Backend -> Gateway
+    GATEWAY_REGISTER    =   0x01,   // value: seats in the room
+    GATEWAY_LOAD        =   0x02,   // value: players in the room
+    GATEWAY_DRAIN       =   0x03,   // no new players from now on
+
+    // Gateway -> Backend
+    GATEWAY_WELCOME     =   0x10,   // value: id of the backend
+    GATEWAY_PLAYER      =   0x11,   // carries the connection, packet is what it sent first
+} gateway_msg_type_t;
+
+typedef struct gateway_msg_s
+{
+    uint32_t    type;
+    uint32_t    value;
+    packet_t    packet;
+} gateway_msg_t;
+
+static inline int gateway_token_backend(uint64_t token) {
+    return token >> GATEWAY_BACKEND_SHIFT;
+}
@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 typedef enum packet_type_e {
     // Server -> Client
     SERVER_GAME_STATUS      =   0x01,
@@ -9,11 +11,25 @@ typedef enum packet_type_e {
     SERVER_PLAYER_REMOVE    =   0x04,
     SERVER_PLAYER_JOIN      =   0x05,
     SERVER_NEW_WORD         =   0x06,
+    SERVER_PING             =   0x0A,
+    SERVER_UDP_OFFER        =   0x0C,
+    SERVER_PROGRESS         =   0x0E,
+    SERVER_LEADERBOARD      =   0x10,
+    SERVER_PLAYER_PLACE     =   0x12,
+    SERVER_RESUME           =   0x13,
 
     // Client -> Server
     CLIENT_PLAYER_INFOS     =   0x07,
     CLIENT_WORD_COMPLETE    =   0x08,
     CLIENT_DISCONNECT       =   0x09,
+    CLIENT_PONG             =   0x0B,
+    CLIENT_PROGRESS         =   0x0F,
+    CLIENT_LEADERBOARD      =   0x11,
+    CLIENT_RESUME           =   0x14,
+    CLIENT_TYPING_SUMMARY   =   0x15,
+
+    // Datagram channel, both directions
+    UDP_HELLO               =   0x0D,
 } packet_type_t;
 
 typedef enum net_status_e {
@@ -38,18 +54,14 @@ typedef enum game_state_e {
     RUNNING     =   0x02,
 } game_state_t;
 
+// deadline is expressed in the receiver's CLOCK_MONOTONIC (ns), 0 when paused
 typedef struct server_game_status_s
 {
     game_state_t    state;
     int             time_remain;
+    int64_t         deadline;
 } server_game_status_t;
 
-// SERVER_PLAYER_ACCEPT
-typedef struct server_player_accept_s
-{
-    int     player_id;
-} server_player_accept_t;
-
 // SERVER_PLAYER_UPDATE
 typedef enum player_mode_e {
     PLAYER,
@@ -63,6 +75,14 @@ typedef struct player_info_s
     int             score;
 } player_info_t;
 
+// SERVER_PLAYER_ACCEPT: the token resumes the session over a new
+// connection if this one breaks
+typedef struct server_player_accept_s
+{
+    player_info_t   info;
+    uint64_t        token;
+} server_player_accept_t;
+
 // SERVER_PLAYER_REMOVE
 typedef struct server_player_remove_s
 {
@@ -85,6 +105,15 @@ typedef struct server_player_join_s
     char            name[MAX_PLAYER_NAME_SIZE];
 } server_player_join_t;
 
+// SERVER_PLAYER_PLACE: a racer moved to place (1 for the leader), everyone
+// from there down to its previous place slides one place down. A racer not
+// yet placed is inserted. Sent in order on the stream only.
+typedef struct server_player_place_s
+{
+    int     player_id;
+    int     place;
+} server_player_place_t;
+
 // SERVER_NEW_WORD
 
 typedef struct server_new_word_s
@@ -92,6 +121,78 @@ typedef struct server_new_word_s
     packet_string_t word;
 } server_new_word_t;
 
+// SERVER_PING
+typedef struct server_ping_s
+{
+    int64_t     sent;
+} server_ping_t;
+
+// SERVER_PROGRESS: one 24 bit entry per player whose progress changed since
+// the previous tick, packed back to back: player id (13) | word (6) | chars (5)
+#define     PROGRESS_ID_BITS        13
+#define     PROGRESS_WORD_BITS      6
+#define     PROGRESS_CHAR_BITS      5
+#define     PROGRESS_ENTRY_BYTES    3
+#define     MAX_PROGRESS_ENTRIES    10
+
+typedef struct server_progress_s
+{
+    uint8_t     count;
+    uint8_t     entries[MAX_PROGRESS_ENTRIES * PROGRESS_ENTRY_BYTES];
+} server_progress_t;
+
+static inline void progress_entry_write(server_progress_t *progress, int player_id, int word, int chars) {
+    uint32_t bits = ((uint32_t)player_id & ((1u << PROGRESS_ID_BITS) - 1)) << (PROGRESS_WORD_BITS + PROGRESS_CHAR_BITS)
+        | ((uint32_t)word & ((1u << PROGRESS_WORD_BITS) - 1)) << PROGRESS_CHAR_BITS
+        | ((uint32_t)chars & ((1u << PROGRESS_CHAR_BITS) - 1));
+    uint8_t *entry = progress->entries + progress->count++ * PROGRESS_ENTRY_BYTES;
+
+    entry[0] = bits;
+    entry[1] = bits >> 8;
+    entry[2] = bits >> 16;
+}
+
+static inline void progress_entry_read(const server_progress_t *progress, int idx, int *player_id, int *word, int *chars) {
+    const uint8_t *entry = progress->entries + idx * PROGRESS_ENTRY_BYTES;
+    uint32_t bits = entry[0] | entry[1] << 8 | (uint32_t)entry[2] << 16;
+
+    *chars = bits & ((1u << PROGRESS_CHAR_BITS) - 1);
+    *word = (bits >> PROGRESS_CHAR_BITS) & ((1u << PROGRESS_WORD_BITS) - 1);
+    *player_id = bits >> (PROGRESS_WORD_BITS + PROGRESS_CHAR_BITS);
+}
+
+// SERVER_UDP_OFFER: sent on the stream when the client asked for datagrams,
+// the token has to come back in every datagram
+typedef struct server_udp_offer_s
+{
+    uint32_t    token;
+} server_udp_offer_t;
+
+// SERVER_RESUME: answers a CLIENT_RESUME. Accepted, the packets the client
+// missed follow, then every player's current score. Refused, the client
+// joins again with CLIENT_PLAYER_INFOS on the same connection.
+typedef struct server_resume_s
+{
+    int         accepted;
+    uint32_t    replayed;
+} server_resume_t;
+
+// SERVER_LEADERBOARD: answers a CLIENT_LEADERBOARD with one packet per row,
+// the top rows first, then the requester's own row if it has one, then a
+// row with rank 0 closing the list. wpm is in hundredths, accuracy in
+// hundredths of a percent.
+#define     MAX_LEADERBOARD_ROWS    10
+
+typedef struct server_leaderboard_s
+{
+    int32_t     rank;
+    uint32_t    total;
+    uint32_t    wpm;
+    uint16_t    accuracy;
+    uint16_t    races;
+    char        name[MAX_PLAYER_NAME_SIZE];
+} server_leaderboard_t;
+
 
 
 ////////////// CLIENT PACKETS ///////////////
@@ -104,19 +205,85 @@ typedef struct client_player_infos_s
 {
     int     start_words;
     char    name[MAX_PLAYER_NAME_SIZE];
+    int     udp;
+    int     progress;
 } client_player_infos_t;
 
-// CLIENT_WORD_COMPLETE
+// CLIENT_WORD_COMPLETE: keystrokes typed this race so far, and how many of
+// them did not match the word. The word itself is proven by its hash, and
+// typing_ms spans its first to its last keystroke.
 typedef struct client_word_complete_s
 {
+    uint32_t    keys;
+    uint32_t    errors;
+    uint32_t    hash;
+    uint32_t    typing_ms;
 } client_word_complete_t;
 
+// FNV-1a over the characters of a word
+static inline uint32_t packet_word_hash(const char *word) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < MAX_STRING_SIZE && word[i] != 0; ++i)
+        hash = (hash ^ (unsigned char)word[i]) * 16777619u;
+    return hash;
+}
+
 // CLIENT_DISCONNECT
 typedef struct client_disconnect_s
 {
     packet_string_t reason;
 } client_disconnect_t;
 
+// CLIENT_PROGRESS: characters typed in the current word, at most once per
+// frame. word is the number of words completed this race, so a report that
+// raced a CLIENT_WORD_COMPLETE can be told apart.
+typedef struct client_progress_s
+{
+    uint8_t     word;
+    uint8_t     chars;
+} client_progress_t;
+
+// CLIENT_PONG: echoes the ping and stamps the client's monotonic clock
+typedef struct client_pong_s
+{
+    int64_t     sent;
+    int64_t     received;
+} client_pong_t;
+
+// CLIENT_RESUME: first packet of a new connection taking over a broken
+// session, received counts the packets the client got on the stream for
+// which packet_replayed holds
+typedef struct client_resume_s
+{
+    uint64_t    token;
+    uint32_t    received;
+} client_resume_t;
+
+// CLIENT_LEADERBOARD: asks for the count best players and our own rank
+typedef struct client_leaderboard_s
+{
+    uint32_t    count;
+} client_leaderboard_t;
+
+// CLIENT_TYPING_SUMMARY: how the race that just ended was typed, sent once
+// by clients that opted in. Speeds are in hundredths of WPM, accuracy in
+// hundredths of a percent. Latencies are in milliseconds, from a key to the
+// next one of the same word (bigram) or to the one after (trigram).
+typedef struct client_typing_summary_s
+{
+    uint32_t    wpm;
+    uint32_t    peak_wpm;
+    uint16_t    accuracy;
+    uint16_t    bigram_p50;
+    uint16_t    bigram_p90;
+    uint16_t    trigram_p50;
+    uint16_t    slowest_bigram_ms;
+    uint16_t    slowest_trigram_ms;
+    char        slowest_bigram[2];
+    char        slowest_trigram[3];
+} client_typing_summary_t;
+
 
 
 ////////////// PACKET DATA ///////////////
@@ -130,17 +297,83 @@ typedef struct packet_s
         union
         {
             server_game_status_t    game_status;
-            player_info_t           player_accept;
+            server_player_accept_t  player_accept;
             player_info_t           player_update;
             server_player_remove_t  player_remove;
             server_player_join_t    player_join;
             server_new_word_t       new_word;
+            server_ping_t           ping;
+            server_udp_offer_t      udp_offer;
+            server_progress_t       progress;
+            server_leaderboard_t    leaderboard;
+            server_player_place_t   player_place;
+            server_resume_t         resume;
         }           server;
         union
         {
             client_player_infos_t   player_infos;
             client_disconnect_t     player_leave;
             client_word_complete_t  word_complete;
+            client_pong_t           pong;
+            client_progress_t       progress;
+            client_leaderboard_t    leaderboard;
+            client_resume_t         resume;
+            client_typing_summary_t typing_summary;
         }           client;
     } packet;
 } packet_t;
+
+// What a client may send on its stream: anything else is a framing error
+static inline int packet_from_client(packet_type_t id) {
+    switch (id)
+    {
+    case CLIENT_PLAYER_INFOS:
+    case CLIENT_WORD_COMPLETE:
+    case CLIENT_DISCONNECT:
+    case CLIENT_PONG:
+    case CLIENT_PROGRESS:
+    case CLIENT_LEADERBOARD:
+    case CLIENT_RESUME:
+    case CLIENT_TYPING_SUMMARY:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+// Strings of a packet are not terminated when they fill their field. Shown
+// to players and logs: printable ASCII only, and not empty.
+static inline int packet_string_valid(const char *str, int size) {
+    int i = 0;
+
+    while (i < size && str[i] >= ' ' && str[i] <= '~')
+        ++i;
+    return i > 0 && (i == size || str[i] == 0);
+}
+
+// Ordered packets a resumed session replays. Scores and progress are resent
+// as current values instead, and replaying pings would be pointless.
+static inline int packet_replayed(packet_type_t id) {
+    return id != SERVER_PING && id != SERVER_PROGRESS && id != SERVER_PLAYER_UPDATE && id != SERVER_RESUME;
+}
+
+
+
+////////////// DATAGRAMS ///////////////
+
+// Latest-value-wins state (scores) may travel over UDP once the client sent
+// a UDP_HELLO with its token to the server's port and got one back. seq grows
+// per sender: a receiver drops a datagram older than the last one it applied
+// for the same player. Joins, words and game status stay on the stream.
+typedef struct datagram_s
+{
+    uint32_t    token;
+    uint32_t    seq;
+    packet_t    packet;
+} datagram_t;
+
+// Wrap-safe "a is not newer than b"
+static inline int datagram_stale(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) <= 0;
+}
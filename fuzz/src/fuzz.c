@@ -0,0 +1,752 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+// In-process fuzzing of the server's packet framing and game dispatch. The
+// server is compiled into this binary with a reactor that never touches a
+// socket: an input is a script of connections, packets and loop passes
+// played against one room, reset between inputs.
+//
+// Input: one configuration byte (bit 0: timing checks on), then operations.
+// Each starts with a byte holding the connection slot (high nibble) and the
+// operation (low nibble), followed by its operands.
+//
+// Each input is a full session through the real dispatch: expect hundreds of
+// thousands of inputs per second on one core, a third of that sanitized.
+
+// Logging would dominate the run: arguments are still evaluated, nothing
+// is formatted
+static inline int quiet_printf(const char *fmt, ...) {
+    (void)fmt;
+    return 0;
+}
+
+static inline int quiet_fprintf(FILE *stream, const char *fmt, ...) {
+    (void)stream;
+    (void)fmt;
+    return 0;
+}
+
+static inline void quiet_perror(const char *str) {
+    (void)str;
+}
+
+// Descriptors of the room are made up: nothing to tune or ask the kernel
+static inline int quiet_setsockopt(int socket, int level, int name, const void *value, socklen_t size) {
+    (void)socket;
+    (void)level;
+    (void)name;
+    (void)value;
+    (void)size;
+    return 0;
+}
+
+static inline int quiet_getpeername(int socket, struct sockaddr *addr, socklen_t *size) {
+    (void)socket;
+    memset(addr, 0, *size);
+    return 0;
+}
+
+// Time and session tokens come from the input's own run, not the kernel:
+// both were syscalls on every join and tick, and a crash replays the same
+// way. The clock only moves on OP_TICK.
+#include "metrics.h"
+
+static int64_t FUZZ_NOW;
+static uint64_t FUZZ_TOKENS;
+
+static inline int64_t fuzz_clock(void) {
+    return FUZZ_NOW;
+}
+
+static inline ssize_t fuzz_getrandom(void *buffer, size_t size, unsigned flags) {
+    uint64_t token = ++FUZZ_TOKENS * 0x9e3779b97f4a7c15ull;
+
+    (void)flags;
+    memcpy(buffer, &token, size < sizeof(token) ? size : sizeof(token));
+    return size;
+}
+
+#define     printf          quiet_printf
+#define     fprintf         quiet_fprintf
+#define     perror          quiet_perror
+#define     setsockopt      quiet_setsockopt
+#define     getpeername     quiet_getpeername
+#define     clock_now_ns    fuzz_clock
+#define     getrandom       fuzz_getrandom
+
+#define     FUZZ
+#include "server.c"
+
+#undef      printf
+#undef      fprintf
+#undef      perror
+#undef      setsockopt
+#undef      getpeername
+#undef      clock_now_ns
+#undef      getrandom
+
+#define     FUZZ_SLOTS          (MAX_PLAYERS + 2)
+// Descriptors the room sees, at the top of the range so none is ever open
+#define     FUZZ_FD_BASE        (FD_SETSIZE - FUZZ_SLOTS)
+#define     FUZZ_LISTENER       (FUZZ_FD_BASE - 1)
+#define     FUZZ_PAYLOAD        sizeof(((packet_t *)0)->packet)
+#define     FUZZ_MAX_INPUT      4096
+#define     FUZZ_MAX_SEEDS      256
+// Deadlines and the session grace are a few dozen ticks away at most
+#define     FUZZ_TICK_STEP      (250 * NS_PER_MS)
+
+typedef enum fuzz_op_e {
+    OP_CONNECT,     // a client connects on the slot
+    OP_PACKET,      // id selector, then up to a payload: one whole packet
+    OP_BYTES,       // length, then raw bytes: framing is left to the server
+    OP_CLOSE,       // end of stream
+    OP_BREAK,       // sends to the slot fail from now on
+    OP_TICK,        // the clock moves (high nibble + 1) * FUZZ_TICK_STEP, then
+                    // housekeeping of one loop iteration
+    OP_FLIP,        // the race starts or ends now
+    FUZZ_OPS
+} fuzz_op_t;
+
+// Packet id selector: the low bits pick one of these, 8 and up are sent as
+// raw ids. The high bit fills in what a real client would know: its session
+// token when resuming, the hash of its word when completing.
+#define     FUZZ_PATCH          0x80
+
+static const packet_type_t CLIENT_IDS[] = {
+    CLIENT_PLAYER_INFOS,
+    CLIENT_WORD_COMPLETE,
+    CLIENT_DISCONNECT,
+    CLIENT_PONG,
+    CLIENT_PROGRESS,
+    CLIENT_LEADERBOARD,
+    CLIENT_RESUME,
+    CLIENT_TYPING_SUMMARY,
+};
+
+static game_server_t GAME;
+static int BROKEN_SLOTS;
+// Operations played, over every input
+static uint64_t FUZZ_STEPS;
+
+
+
+/////////// REACTOR ////////////
+
+static int fuzz_reactor_init(reactor_t *reactor) {
+    (void)reactor;
+    return 0;
+}
+
+static void fuzz_reactor_destroy(reactor_t *reactor) {
+    (void)reactor;
+}
+
+static int fuzz_reactor_add(reactor_t *reactor, int socket) {
+    (void)reactor;
+    return socket < FD_SETSIZE ? 0 : -1;
+}
+
+static void fuzz_reactor_unwatch(reactor_t *reactor, int socket) {
+    (void)reactor;
+    (void)socket;
+}
+
+static ssize_t fuzz_reactor_send(reactor_t *reactor, int socket, const void *data, size_t size) {
+    (void)reactor;
+    (void)data;
+    if (socket < FUZZ_FD_BASE || socket >= FD_SETSIZE || BROKEN_SLOTS & 1 << (socket - FUZZ_FD_BASE))
+        return -1;
+    return size;
+}
+
+static int fuzz_reactor_wait(reactor_t *reactor, const struct timespec *timeout, const sigset_t *sigset) {
+    (void)reactor;
+    (void)timeout;
+    (void)sigset;
+    return 0;
+}
+
+static void fuzz_reactor_noop(reactor_t *reactor) {
+    (void)reactor;
+}
+
+static const reactor_backend_t REACTOR_FUZZ = {
+    .name="fuzz",
+    .init=fuzz_reactor_init,
+    .destroy=fuzz_reactor_destroy,
+    .listen=fuzz_reactor_add,
+    .watch=fuzz_reactor_add,
+    .poll=fuzz_reactor_add,
+    .unwatch=fuzz_reactor_unwatch,
+    .send=fuzz_reactor_send,
+    .wait=fuzz_reactor_wait,
+    .flush=fuzz_reactor_noop,
+    .quiesce=fuzz_reactor_noop,
+    .resume=fuzz_reactor_noop,
+};
+
+// Stands in for reactor.c, which closes for real: one syscall per socket
+int reactor_init(reactor_t *reactor, const char *backend, reactor_handler_t handler) {
+    (void)backend;
+    reactor->backend = &REACTOR_FUZZ;
+    reactor->handler = handler;
+    reactor->impl = NULL;
+    return 0;
+}
+
+void reactor_close(reactor_t *reactor, int socket) {
+    if (socket >= 0)
+        reactor->backend->unwatch(reactor, socket);
+}
+
+
+
+/////////// ROOM ////////////
+
+void fuzz_room_init(game_server_t *game, const char *words) {
+    *game = (game_server_t){
+        .socket=FUZZ_LISTENER,
+        .udp=-1,
+        .await=-1,
+        .admin=-1,
+        .upgrade=-1,
+        .handoff=-1,
+        .gateway=-1,
+        .log={.fd=-1},
+        .board={.wal=-1},
+        .reactor={.backend=&REACTOR_FUZZ, .handler={
+            .ctx=game,
+            .accept=net_client_accept,
+            .data=net_client_read,
+            .send_error=net_client_send_error,
+            .readable=net_readable
+        }}
+    };
+    arena_init(&game->arena, MEM_WORDS);
+    game->words = word_list_create(&game->arena, words);
+}
+
+// Back to an empty waiting room, as cheaply as possible
+void fuzz_room_reset(game_server_t *game) {
+    for (int i = 0; i < FUZZ_SLOTS; ++i)
+        CONNECTIONS[FUZZ_FD_BASE + i] = (connection_t){0};
+    game->state = WAITTING;
+    game->deadline = 0;
+    game->started = 0;
+    game->next_progress = 0;
+    game->player_count = 0;
+    game->await = -1;
+    game->flags = 0;
+    game->last = game->words;
+    game->standings.count = 0;
+    NEXT_PLAYER_ID = 0;
+    BROKEN_SLOTS = 0;
+    FUZZ_NOW = NS_PER_SEC;
+    FUZZ_TOKENS = 0;
+}
+
+static void fuzz_tick(game_server_t *game) {
+    int64_t now = fuzz_clock();
+
+    game_progress_tick(game, now);
+    while (game->flags & FLAG_BROKEN_SOCK)
+        game_server_clean(game);
+    game_expire_sessions(game, now);
+    if (game->deadline != 0 && now >= game_adjudication_time(game))
+        game->state == RUNNING ? game_end(game, game_find_winner(game)) : game_start(game);
+}
+
+static void fuzz_packet(game_server_t *game, int socket, uint8_t selector, const uint8_t *payload, size_t size) {
+    packet_t packet = {.id=(selector & 0x7f) < 8 ? CLIENT_IDS[selector & 7] : (packet_type_t)(selector & 0x7f)};
+    player_t *player = game_find_player(game, socket);
+
+    memcpy(&packet.packet, payload, size);
+    if (selector & FUZZ_PATCH) {
+        if (packet.id == CLIENT_RESUME && game->player_count > 0)
+            packet.packet.client.resume.token = game->players[payload[0] % game->player_count].session.token;
+        else if (packet.id == CLIENT_WORD_COMPLETE && player != NULL && player->typing != NULL)
+            packet.packet.client.word_complete.hash = player->typing->hash;
+    }
+    net_client_read(game, socket, (const char *)&packet, sizeof(packet));
+}
+
+int fuzz_run(game_server_t *game, const uint8_t *data, size_t size) {
+    const uint8_t *end = data + size;
+    size_t len;
+    uint8_t arg;
+    int socket;
+    int slot;
+
+    fuzz_room_reset(game);
+    if (size == 0)
+        return 0;
+    TIMING_CHECKS = *data++ & 1;
+    while (data < end) {
+        FUZZ_STEPS++;
+        arg = *data >> 4;
+        slot = arg % FUZZ_SLOTS;
+        socket = FUZZ_FD_BASE + slot;
+        switch ((*data++ & 0x0f) % FUZZ_OPS)
+        {
+        case OP_CONNECT:
+            // The kernel never hands out a descriptor still in use
+            if (!CONNECTIONS[socket].open && game_find_player(game, socket) == NULL) {
+                BROKEN_SLOTS &= ~(1 << slot);
+                net_client_accept(game, game->socket, socket);
+            }
+            break;
+
+        case OP_PACKET:
+            if (data == end)
+                return 0;
+            len = (size_t)(end - data - 1) < FUZZ_PAYLOAD ? (size_t)(end - data - 1) : FUZZ_PAYLOAD;
+            fuzz_packet(game, socket, data[0], data + 1, len);
+            data += 1 + len;
+            break;
+
+        case OP_BYTES:
+            if (data == end)
+                return 0;
+            len = *data++;
+            if (len > (size_t)(end - data))
+                len = end - data;
+            if (len > 0 && CONNECTIONS[socket].open)
+                net_client_read(game, socket, (const char *)data, len);
+            data += len;
+            break;
+
+        case OP_CLOSE:
+            if (CONNECTIONS[socket].open)
+                net_client_read(game, socket, NULL, 0);
+            break;
+
+        case OP_BREAK:
+            BROKEN_SLOTS |= 1 << slot;
+            break;
+
+        case OP_TICK:
+            FUZZ_NOW += (arg + 1) * FUZZ_TICK_STEP;
+            fuzz_tick(game);
+            break;
+
+        case OP_FLIP:
+            if (game->state == RUNNING)
+                game_end(game, game_find_winner(game));
+            else if (game->player_count >= MIN_PLAYERS)
+                game_start(game);
+            break;
+        }
+    }
+    fuzz_tick(game);
+    return 0;
+}
+
+
+
+/////////// CRASHES ////////////
+
+// The input being run, written out when it brings the process down
+static const uint8_t *CURRENT;
+static size_t CURRENT_SIZE;
+
+static void fuzz_dump(void) {
+    char path[] = "crash-input";
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+        return;
+    if (write(fd, CURRENT, CURRENT_SIZE) < 0)
+        CURRENT_SIZE = 0;
+    close(fd);
+    if (write(STDERR_FILENO, "[ERROR] Input written to crash-input\n", 37) < 0)
+        return;
+}
+
+static void fuzz_crash(int sig) {
+    fuzz_dump();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void fuzz_watch_crashes(void) {
+    static const int SIGNALS[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL};
+
+    for (size_t i = 0; i < sizeof(SIGNALS) / sizeof(*SIGNALS); ++i)
+        signal(SIGNALS[i], fuzz_crash);
+#ifdef __SANITIZE_ADDRESS__
+    __sanitizer_set_death_callback(fuzz_dump);
+#endif
+}
+
+static int fuzz_one(const uint8_t *data, size_t size) {
+    CURRENT = data;
+    CURRENT_SIZE = size;
+    return fuzz_run(&GAME, data, size);
+}
+
+
+
+/////////// CORPUS ////////////
+
+typedef struct seed_s
+{
+    uint8_t     data[FUZZ_MAX_INPUT];
+    size_t      size;
+} seed_t;
+
+typedef struct corpus_s
+{
+    seed_t     *seeds;
+    int         count;
+} corpus_t;
+
+static int corpus_load_file(seed_t *seed, const char *path) {
+    int fd = open(path, O_RDONLY);
+    ssize_t size;
+
+    if (fd < 0)
+        return -1;
+    size = read(fd, seed->data, FUZZ_MAX_INPUT);
+    close(fd);
+    if (size < 0)
+        return -1;
+    seed->size = size;
+    return 0;
+}
+
+void corpus_load(corpus_t *corpus, const char *dir) {
+    char path[PATH_MAX];
+    struct dirent *entry;
+    DIR *d = opendir(dir);
+
+    if (d == NULL) {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+    if ((corpus->seeds = calloc(FUZZ_MAX_SEEDS, sizeof(seed_t))) == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    while ((entry = readdir(d)) != NULL && corpus->count < FUZZ_MAX_SEEDS) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (corpus_load_file(corpus->seeds + corpus->count, path) == 0)
+            corpus->count++;
+    }
+    closedir(d);
+    if (corpus->count == 0) {
+        fprintf(stderr, "[ERROR] Empty corpus: %s\n", dir);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void seed_put(seed_t *seed, const void *data, size_t size) {
+    memcpy(seed->data + seed->size, data, size);
+    seed->size += size;
+}
+
+static void seed_op(seed_t *seed, int slot, fuzz_op_t op) {
+    seed_put(seed, &(uint8_t){slot << 4 | op}, 1);
+}
+
+static void seed_packet(seed_t *seed, int slot, uint8_t selector, const void *payload, size_t size) {
+    seed_op(seed, slot, OP_PACKET);
+    seed_put(seed, &selector, 1);
+    seed_put(seed, payload, size);
+    // Zero padded up to the next operation
+    memset(seed->data + seed->size, 0, FUZZ_PAYLOAD - size);
+    seed->size += FUZZ_PAYLOAD - size;
+}
+
+static void seed_join(seed_t *seed, int slot, const char *name) {
+    client_player_infos_t infos = {.start_words=3};
+
+    memcpy(infos.name, name, strnlen(name, MAX_PLAYER_NAME_SIZE));
+    seed_op(seed, slot, OP_CONNECT);
+    seed_packet(seed, slot, 0, &infos, sizeof(infos));
+}
+
+static void seed_complete(seed_t *seed, int slot, uint32_t keys) {
+    client_word_complete_t complete = {.keys=keys, .typing_ms=1000};
+
+    seed_packet(seed, slot, 1 | FUZZ_PATCH, &complete, sizeof(complete));
+}
+
+static void seed_write(const seed_t *seed, const char *dir, const char *name) {
+    char path[PATH_MAX];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0
+        || write(fd, seed->data, seed->size) != (ssize_t)seed->size) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+// Sessions a well-behaved client goes through, to start mutating from
+void corpus_generate(const char *dir) {
+    client_player_infos_t infos = {.start_words=3, .name="Spectator"};
+    client_disconnect_t leave = {.reason="Client disconnect"};
+    client_typing_summary_t summary = {.wpm=9000, .peak_wpm=11000, .accuracy=9800, .bigram_p50=120};
+    client_progress_t progress = {.word=1, .chars=2};
+    client_leaderboard_t board = {.count=5};
+    client_pong_t pong = {.sent=1, .received=2};
+    packet_t join = {.id=CLIENT_PLAYER_INFOS, .packet.client.player_infos={.start_words=3, .name="Fragments"}};
+    seed_t seed;
+
+    mkdir(dir, 0755);
+
+    // A whole race between two players
+    seed = (seed_t){.data={0}, .size=1};
+    seed_join(&seed, 0, "alice");
+    seed_join(&seed, 1, "bob");
+    seed_op(&seed, 0, OP_FLIP);
+    seed_packet(&seed, 0, 3, &pong, sizeof(pong));
+    for (uint32_t i = 1; i <= 4; ++i) {
+        seed_complete(&seed, 0, i * 6);
+        seed_packet(&seed, 1, 4, &progress, sizeof(progress));
+    }
+    seed_complete(&seed, 1, 5);
+    seed_packet(&seed, 1, 5, &board, sizeof(board));
+    seed_op(&seed, 0, OP_TICK);
+    seed_op(&seed, 0, OP_FLIP);
+    seed_packet(&seed, 0, 7, &summary, sizeof(summary));
+    seed_packet(&seed, 1, 2, &leave, sizeof(leave));
+    seed_write(&seed, dir, "race");
+
+    // A connection breaks mid-race and its client resumes the seat
+    seed = (seed_t){.data={0}, .size=1};
+    seed_join(&seed, 0, "alice");
+    seed_join(&seed, 1, "bob");
+    seed_op(&seed, 0, OP_FLIP);
+    seed_complete(&seed, 0, 5);
+    seed_op(&seed, 0, OP_BREAK);
+    seed_complete(&seed, 1, 4);
+    seed_op(&seed, 0, OP_TICK);
+    seed_op(&seed, 2, OP_CONNECT);
+    seed_packet(&seed, 2, 6 | FUZZ_PATCH, &(client_resume_t){0}, sizeof(client_resume_t));
+    seed_complete(&seed, 2, 11);
+    seed_op(&seed, 1, OP_CLOSE);
+    seed_op(&seed, 0, OP_TICK);
+    seed_write(&seed, dir, "resume");
+
+    // Packets split and merged across reads
+    seed = (seed_t){.data={1}, .size=1};
+    seed_op(&seed, 0, OP_CONNECT);
+    for (size_t off = 0, chunk = 7; off < sizeof(join); off += chunk, chunk += 6) {
+        chunk = chunk < sizeof(join) - off ? chunk : sizeof(join) - off;
+        seed_op(&seed, 0, OP_BYTES);
+        seed_put(&seed, &(uint8_t){chunk}, 1);
+        seed_put(&seed, (const char *)&join + off, chunk);
+    }
+    seed_op(&seed, 0, OP_BYTES);
+    seed_put(&seed, &(uint8_t){2 * sizeof(packet_t)}, 1);
+    seed_put(&seed, &(packet_t){.id=CLIENT_LEADERBOARD, .packet.client.leaderboard={.count=3}}, sizeof(packet_t));
+    seed_put(&seed, &(packet_t){.id=CLIENT_PONG, .packet.client.pong={.sent=1}}, sizeof(packet_t));
+    seed_write(&seed, dir, "fragments");
+
+    // More clients than seats, and one watching a race
+    seed = (seed_t){.data={1}, .size=1};
+    for (int i = 0; i < MAX_PLAYERS; ++i)
+        seed_join(&seed, i, (const char *[]){"alice", "bob", "carol", "dave"}[i]);
+    seed_op(&seed, 0, OP_FLIP);
+    seed_op(&seed, MAX_PLAYERS, OP_CONNECT);
+    seed_packet(&seed, MAX_PLAYERS, 0, &infos, sizeof(infos));
+    seed_packet(&seed, 2, 2, &leave, sizeof(leave));
+    seed_op(&seed, MAX_PLAYERS, OP_CONNECT);
+    seed_packet(&seed, MAX_PLAYERS, 0, &infos, sizeof(infos));
+    seed_op(&seed, 0, OP_TICK);
+    seed_write(&seed, dir, "crowd");
+
+    // What the server has to refuse
+    seed = (seed_t){.data={1}, .size=1};
+    seed_op(&seed, 0, OP_CONNECT);
+    seed_packet(&seed, 0, 0, &(client_player_infos_t){.start_words=3, .name="\x1b[2J"}, sizeof(client_player_infos_t));
+    seed_packet(&seed, 0, 0, &(client_player_infos_t){.start_words=99, .name="greedy"}, sizeof(client_player_infos_t));
+    seed_packet(&seed, 0, 1, &(client_word_complete_t){0}, sizeof(client_word_complete_t));
+    seed_join(&seed, 1, "eve");
+    seed_packet(&seed, 1, SERVER_NEW_WORD, &(server_new_word_t){0}, sizeof(server_new_word_t));
+    seed_op(&seed, 1, OP_TICK);
+    seed_write(&seed, dir, "refused");
+    printf("[INFO] Seed corpus written to %s\n", dir);
+}
+
+
+
+/////////// MUTATIONS ////////////
+
+static uint64_t RANDOM = 0x9e3779b97f4a7c15ull;
+
+static inline uint64_t fuzz_random(void) {
+    RANDOM ^= RANDOM << 13;
+    RANDOM ^= RANDOM >> 7;
+    RANDOM ^= RANDOM << 17;
+    return RANDOM;
+}
+
+static const int32_t INTERESTING[] = {0, 1, -1, 2, 3, 10, 11, MAX_SCORE, MAX_SCORE + 1, 127, 128, 255, 256,
+    INT16_MAX, INT16_MIN, INT32_MAX, INT32_MIN};
+
+// A few random edits: bit flips, interesting values, chunks inserted,
+// removed or spliced in from another seed
+size_t fuzz_mutate(uint8_t *data, size_t size, const corpus_t *corpus) {
+    int edits = 1 + fuzz_random() % 4;
+    const seed_t *other;
+    size_t pos;
+    size_t len;
+    int32_t value;
+
+    while (edits-- > 0) {
+        pos = size > 0 ? fuzz_random() % size : 0;
+        switch (fuzz_random() % 6)
+        {
+        case 0:
+            if (size > 0)
+                data[pos] ^= 1 << fuzz_random() % 8;
+            break;
+
+        case 1:
+            if (size > 0)
+                data[pos] = INTERESTING[fuzz_random() % (sizeof(INTERESTING) / sizeof(*INTERESTING))];
+            break;
+
+        case 2:
+            value = INTERESTING[fuzz_random() % (sizeof(INTERESTING) / sizeof(*INTERESTING))];
+            if (pos + sizeof(value) <= size)
+                memcpy(data + pos, &value, sizeof(value));
+            break;
+
+        case 3:
+            len = 1 + fuzz_random() % 16;
+            if (pos + len > size)
+                len = size - pos;
+            memmove(data + pos, data + pos + len, size - pos - len);
+            size -= len;
+            break;
+
+        case 4:
+            len = 1 + fuzz_random() % 16;
+            if (size + len > FUZZ_MAX_INPUT)
+                break;
+            memmove(data + pos + len, data + pos, size - pos);
+            for (size_t i = 0; i < len; ++i)
+                data[pos + i] = fuzz_random();
+            size += len;
+            break;
+
+        case 5:
+            other = corpus->seeds + fuzz_random() % corpus->count;
+            if (other->size < 2)
+                break;
+            len = 1 + fuzz_random() % (other->size - 1);
+            if (size + len > FUZZ_MAX_INPUT)
+                len = FUZZ_MAX_INPUT - size;
+            memmove(data + pos + len, data + pos, size - pos);
+            memcpy(data + pos, other->data + 1 + fuzz_random() % (other->size - len), len);
+            size += len;
+        }
+    }
+    return size;
+}
+
+
+
+/////////// MAIN ////////////
+
+static inline double fuzz_seconds(void) {
+    return clock_now_ns() / 1e9;
+}
+
+static const char USAGE[] = "./fuzz [-w words] [-t seconds] [-g] corpus|input\n";
+
+int main(int ac, char **av) {
+    static uint8_t input[FUZZ_MAX_INPUT];
+    const char *words = "../data.txt";
+    corpus_t corpus = {0};
+    struct stat st;
+    double seconds = 10;
+    double started;
+    uint64_t execs = 0;
+    size_t size;
+    int generate = 0;
+    int opt;
+
+    while ((opt = getopt(ac, av, "w:t:g")) != -1) {
+        switch (opt)
+        {
+        case 'w':
+            words = optarg;
+            break;
+
+        case 't':
+            seconds = strtod(optarg, NULL);
+            break;
+
+        case 'g':
+            generate = 1;
+            break;
+
+        default:
+            fprintf(stderr, USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind + 1 != ac) {
+        fprintf(stderr, USAGE);
+        exit(EXIT_FAILURE);
+    }
+    fuzz_room_init(&GAME, words);
+    if (generate) {
+        corpus_generate(av[optind]);
+        return EXIT_SUCCESS;
+    }
+    fuzz_watch_crashes();
+    // A single input: reproducing a crash
+    if (stat(av[optind], &st) == 0 && S_ISREG(st.st_mode)) {
+        corpus.seeds = calloc(1, sizeof(seed_t));
+        if (corpus.seeds == NULL || corpus_load_file(corpus.seeds, av[optind]) < 0) {
+            perror(av[optind]);
+            exit(EXIT_FAILURE);
+        }
+        fuzz_one(corpus.seeds->data, corpus.seeds->size);
+        printf("[INFO] %s ran cleanly\n", av[optind]);
+        return EXIT_SUCCESS;
+    }
+    corpus_load(&corpus, av[optind]);
+    for (int i = 0; i < corpus.count; ++i)
+        fuzz_one(corpus.seeds[i].data, corpus.seeds[i].size);
+    printf("[INFO] %d seeds ran cleanly, mutating for %.0f s\n", corpus.count, seconds);
+    started = fuzz_seconds();
+    do {
+        // The clock is read once per batch, it would cost as much as a run
+        for (int i = 0; i < 1024; ++i, ++execs) {
+            const seed_t *seed = corpus.seeds + fuzz_random() % corpus.count;
+
+            memcpy(input, seed->data, seed->size);
+            size = fuzz_mutate(input, seed->size, &corpus);
+            fuzz_one(input, size);
+        }
+    } while (fuzz_seconds() - started < seconds);
+    seconds = fuzz_seconds() - started;
+    printf("[INFO] %lu inputs in %.1f s, %.0f per second (%.0f operations per second)\n",
+        execs, seconds, execs / seconds, FUZZ_STEPS / seconds);
+    free(corpus.seeds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,378 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gateway.h"
+#include "packet.h"
+
+// Front door of a cluster of tr_server processes on one host. Clients
+// connect here; once their first packet tells where they belong (a room with
+// a free seat, or the room of the session they resume) the connection is
+// passed to that backend and the gateway is out of the data path. Backends
+// come and go at any time: registering makes a room available, draining or
+// exiting stops routing to it, rooms in progress are never touched.
+
+#define     NS_PER_SEC          1000000000ll
+#define     MAX_PENDING         64
+#define     PENDING_TIMEOUT     (5 * NS_PER_SEC)
+#define     LISTEN_BACKLOG      128
+
+typedef struct backend_s
+{
+    int         socket;
+    int         players;
+    int         capacity;
+    int         draining;
+    uint64_t    routed;
+} backend_t;
+
+// Accepted clients whose first packet is still coming in
+typedef struct pending_s
+{
+    int         socket;
+    size_t      filled;
+    packet_t    packet;
+    int64_t     since;
+} pending_t;
+
+typedef struct gateway_s
+{
+    int         running;
+    int         socket;
+    int         backend_socket;
+    const char *backend_path;
+    backend_t   backends[GATEWAY_MAX_BACKENDS];
+    pending_t   pending[MAX_PENDING];
+    int         pending_count;
+    fd_set      set;
+} gateway_t;
+
+static inline int64_t clock_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+
+
+/////////// NETWORK ////////////
+
+void net_init(gateway_t *gateway, const char *host, int port, const char *path) {
+    struct sockaddr_in serv = {.sin_family=PF_INET, .sin_port=htons(port)};
+    struct sockaddr_un addr = {.sun_family=AF_UNIX};
+    int one = 1;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "[ERROR] Backend socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+    inet_aton(host, &serv.sin_addr);
+    if ((gateway->socket = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) < 0
+        || setsockopt(gateway->socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+        || bind(gateway->socket, (struct sockaddr *)&serv, sizeof(serv)) < 0
+        || listen(gateway->socket, LISTEN_BACKLOG) < 0) {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+    printf("[INFO] Gateway listening on %s:%d\n", host, port);
+    unlink(path);
+    if ((gateway->backend_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+        || bind(gateway->backend_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || listen(gateway->backend_socket, GATEWAY_MAX_BACKENDS) < 0) {
+        perror("backend bind");
+        exit(EXIT_FAILURE);
+    }
+    gateway->backend_path = path;
+    printf("[INFO] Backends register on %s\n", path);
+}
+
+static int net_send_msg(int socket, const gateway_msg_t *msg, int fd) {
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    struct iovec iov = {.iov_base=(void *)msg, .iov_len=sizeof(*msg)};
+    struct msghdr hdr = {.msg_iov=&iov, .msg_iovlen=1};
+    struct cmsghdr *cmsg;
+
+    if (fd >= 0) {
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(socket, &hdr, MSG_NOSIGNAL) == sizeof(*msg) ? 0 : -1;
+}
+
+
+
+/////////// BACKENDS ////////////
+
+// Ids are slots + 1: 0 stays free for tokens issued outside a cluster
+static inline int backend_id(const gateway_t *gateway, const backend_t *backend) {
+    return backend - gateway->backends + 1;
+}
+
+void backend_accept(gateway_t *gateway) {
+    int socket = accept(gateway->backend_socket, NULL, NULL);
+
+    if (socket < 0)
+        return;
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; ++i)
+        if (gateway->backends[i].socket == -1 && socket < FD_SETSIZE) {
+            // Not routed to before it registered its seats
+            gateway->backends[i] = (backend_t){.socket=socket};
+            return;
+        }
+    fprintf(stderr, "[ERROR] No room for another backend\n");
+    close(socket);
+}
+
+void backend_remove(gateway_t *gateway, backend_t *backend) {
+    printf("[INFO] Backend %d left with %d players, %lu routed\n", backend_id(gateway, backend), backend->players, backend->routed);
+    close(backend->socket);
+    backend->socket = -1;
+}
+
+void backend_read(gateway_t *gateway, backend_t *backend) {
+    gateway_msg_t msg;
+
+    if (recv(backend->socket, &msg, sizeof(msg), MSG_WAITALL) != sizeof(msg)) {
+        backend_remove(gateway, backend);
+        return;
+    }
+    switch (msg.type)
+    {
+    case GATEWAY_REGISTER:
+        backend->capacity = msg.value;
+        if (net_send_msg(backend->socket, &(gateway_msg_t){.type=GATEWAY_WELCOME, .value=backend_id(gateway, backend)}, -1) < 0) {
+            backend_remove(gateway, backend);
+            return;
+        }
+        printf("[INFO] Backend %d registered with %d seats\n", backend_id(gateway, backend), backend->capacity);
+        break;
+
+    case GATEWAY_LOAD:
+        backend->players = msg.value;
+        break;
+
+    case GATEWAY_DRAIN:
+        backend->draining = 1;
+        printf("[INFO] Backend %d is draining, %d players left\n", backend_id(gateway, backend), backend->players);
+        break;
+
+    default:
+        fprintf(stderr, "[ERROR] Invalid message from backend %d: %u\n", backend_id(gateway, backend), msg.type);
+    }
+}
+
+// Resumed sessions go back to the room that issued their token, if it is
+// still there (elsewhere they are told to join again). New players go to the
+// least occupied room that has someone waiting and a free seat, an empty
+// room only once no such room is left: spreading players one per room would
+// keep every race from starting.
+backend_t *backend_route(gateway_t *gateway, const packet_t *packet) {
+    backend_t *best = NULL;
+    backend_t *backend;
+    int id;
+
+    if (packet->id == CLIENT_RESUME) {
+        id = gateway_token_backend(packet->packet.client.resume.token);
+        if (id > 0 && id <= GATEWAY_MAX_BACKENDS && gateway->backends[id - 1].socket != -1)
+            return gateway->backends + id - 1;
+    }
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; ++i) {
+        backend = gateway->backends + i;
+        if (backend->socket == -1 || backend->draining || backend->players >= backend->capacity)
+            continue;
+        if (best == NULL || (backend->players > 0 && (best->players == 0 || backend->players < best->players)))
+            best = backend;
+    }
+    return best;
+}
+
+
+
+/////////// CLIENTS ////////////
+
+void client_accept(gateway_t *gateway) {
+    int socket = accept(gateway->socket, NULL, NULL);
+    int one = 1;
+
+    if (socket < 0)
+        return;
+    if (gateway->pending_count == MAX_PENDING || socket >= FD_SETSIZE) {
+        fprintf(stderr, "[ERROR] Too many clients waiting, dropping socket %d\n", socket);
+        close(socket);
+        return;
+    }
+    // Set once here, the backend gets the connection as it is
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    gateway->pending[gateway->pending_count++] = (pending_t){.socket=socket, .since=clock_now_ns()};
+}
+
+void client_drop(gateway_t *gateway, int idx) {
+    close(gateway->pending[idx].socket);
+    gateway->pending[idx] = gateway->pending[--gateway->pending_count];
+}
+
+// Everything after the first packet stays in the socket for the backend
+void client_read(gateway_t *gateway, int idx) {
+    pending_t *client = gateway->pending + idx;
+    backend_t *backend;
+    ssize_t size;
+
+    size = read(client->socket, (char *)&client->packet + client->filled, sizeof(packet_t) - client->filled);
+    if (size <= 0) {
+        if (size < 0 && errno == EINTR)
+            return;
+        client_drop(gateway, idx);
+        return;
+    }
+    if ((client->filled += size) < sizeof(packet_t))
+        return;
+    if ((backend = backend_route(gateway, &client->packet)) == NULL) {
+        printf("[INFO] No room for socket %d (packet %d)\n", client->socket, client->packet.id);
+        client_drop(gateway, idx);
+        return;
+    }
+    if (net_send_msg(backend->socket, &(gateway_msg_t){.type=GATEWAY_PLAYER, .packet=client->packet}, client->socket) < 0) {
+        fprintf(stderr, "[ERROR] Could not hand socket %d to backend %d\n", client->socket, backend_id(gateway, backend));
+        client_drop(gateway, idx);
+        return;
+    }
+    // Counted until the backend reports its own figure, which it does
+    // after every player we route
+    backend->players++;
+    backend->routed++;
+    printf("[INFO] Socket %d routed to backend %d\n", client->socket, backend_id(gateway, backend));
+    client_drop(gateway, idx);
+}
+
+void client_expire(gateway_t *gateway, int64_t now) {
+    for (int i = gateway->pending_count - 1; i >= 0; --i)
+        if (now - gateway->pending[i].since >= PENDING_TIMEOUT)
+            client_drop(gateway, i);
+}
+
+
+
+/////////// GATEWAY ////////////
+
+void gateway_init(gateway_t *gateway, const char *host, int port, const char *path) {
+    gateway->pending_count = 0;
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; ++i)
+        gateway->backends[i].socket = -1;
+    net_init(gateway, host, port, path);
+}
+
+void gateway_loop(gateway_t *gateway) {
+    static const struct timespec SELECT_TO = {.tv_sec=0, .tv_nsec=100000000};
+    static sigset_t SIGSET;
+    int max = gateway->socket > gateway->backend_socket ? gateway->socket : gateway->backend_socket;
+
+    sigemptyset(&SIGSET);
+    sigaddset(&SIGSET, SIGINT);
+
+    FD_ZERO(&gateway->set);
+    FD_SET(gateway->socket, &gateway->set);
+    FD_SET(gateway->backend_socket, &gateway->set);
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; ++i)
+        if (gateway->backends[i].socket != -1) {
+            FD_SET(gateway->backends[i].socket, &gateway->set);
+            max = gateway->backends[i].socket > max ? gateway->backends[i].socket : max;
+        }
+    for (int i = 0; i < gateway->pending_count; ++i) {
+        FD_SET(gateway->pending[i].socket, &gateway->set);
+        max = gateway->pending[i].socket > max ? gateway->pending[i].socket : max;
+    }
+    if (pselect(max + 1, &gateway->set, NULL, NULL, &SELECT_TO, &SIGSET) < 0) {
+        if (!gateway->running || errno == EINTR)
+            return;
+        perror("select()");
+        exit(EXIT_FAILURE);
+    }
+    // Registrations and loads first: routing decisions use them
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; ++i)
+        if (gateway->backends[i].socket != -1 && FD_ISSET(gateway->backends[i].socket, &gateway->set))
+            backend_read(gateway, gateway->backends + i);
+    if (FD_ISSET(gateway->backend_socket, &gateway->set))
+        backend_accept(gateway);
+    for (int i = gateway->pending_count - 1; i >= 0; --i)
+        if (FD_ISSET(gateway->pending[i].socket, &gateway->set))
+            client_read(gateway, i);
+    if (FD_ISSET(gateway->socket, &gateway->set))
+        client_accept(gateway);
+    client_expire(gateway, clock_now_ns());
+}
+
+void gateway_start(gateway_t *gateway) {
+    gateway->running = 1;
+    while (gateway->running)
+        gateway_loop(gateway);
+}
+
+// Backends keep their rooms: they only stop getting new players
+void gateway_destroy(gateway_t *gateway) {
+    while (gateway->pending_count > 0)
+        client_drop(gateway, 0);
+    for (int i = 0; i < GATEWAY_MAX_BACKENDS; ++i)
+        if (gateway->backends[i].socket != -1)
+            close(gateway->backends[i].socket);
+    close(gateway->socket);
+    close(gateway->backend_socket);
+    unlink(gateway->backend_path);
+}
+
+
+
+/////////// SIGNAL ////////////
+
+static int *SHUTDOWN = NULL;
+
+void signal_handler(int signal) {
+    if (SHUTDOWN == NULL)
+        fprintf(stderr, "[ERROR] SHUTDOWN not set for signal (%d)\n", signal);
+    else {
+        *SHUTDOWN = 0;
+        printf("[INFO] Gracefully shutting down gateway\n");
+    }
+}
+
+
+/////////// MAIN ////////////
+
+static const char USAGE[] = "./gateway [host] [port] [backend_socket]\n";
+
+int main(int ac, char **av) {
+    gateway_t gateway;
+    int port;
+
+    if (ac != 4) {
+        fprintf(stderr, USAGE);
+        exit(EXIT_FAILURE);
+    }
+    port = strtol(av[2], NULL, 10);
+    if (port == 0) {
+        fprintf(stderr, "[ERROR] Invalid port: %s\n", av[2]);
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGINT, signal_handler);
+    gateway_init(&gateway, av[1], port, av[3]);
+    SHUTDOWN = &gateway.running;
+    gateway_start(&gateway);
+    gateway_destroy(&gateway);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded memory: every dynamic allocation of the server is charged to a
+// subsystem against one process-wide budget. Past the budget allocations
+// fail the way an out of memory malloc would, and a new race only starts
+// while a whole one still fits (MEMORY_ROOM_RESERVE). Counters are atomic:
+// the leaderboard writer thread allocates too.
+
+typedef enum memory_subsystem_e {
+    MEM_WORDS,
+    MEM_NETWORK,
+    MEM_REPLAY,
+    MEM_PLAYBACK,
+    MEM_LEADERBOARD,
+    MEM_SUBSYSTEMS
+} memory_subsystem_t;
+
+#define     MEMORY_DEFAULT_BUDGET   (256ul << 20)
+// A race: its replay log and keyframe index with room to grow
+#define     MEMORY_ROOM_RESERVE     (4ul << 20)
+
+typedef struct memory_budget_s
+{
+    size_t      limit;
+    size_t      total;
+    size_t      peak;
+    size_t      used[MEM_SUBSYSTEMS];
+    uint64_t    refused;
+} memory_budget_t;
+
+extern memory_budget_t MEMORY;
+extern const char *const MEMORY_SUBSYSTEMS[MEM_SUBSYSTEMS];
+
+// For memory obtained elsewhere (mmap), < 0 when it does not fit
+int mem_charge(memory_subsystem_t subsystem, size_t size);
+void mem_discharge(memory_subsystem_t subsystem, size_t size);
+// Zeroed, NULL past the budget
+void *mem_alloc(memory_subsystem_t subsystem, size_t size);
+void *mem_realloc(memory_subsystem_t subsystem, void *ptr, size_t old_size, size_t size);
+void mem_free(memory_subsystem_t subsystem, void *ptr, size_t size);
+
+static inline int mem_room_available(void) {
+    size_t total = __atomic_load_n(&MEMORY.total, __ATOMIC_RELAXED);
+
+    return total + MEMORY_ROOM_RESERVE <= MEMORY.limit;
+}
+
+// Bump allocation from chunks charged to one subsystem, given back all at
+// once when what they hold goes away. The word list is the one user: races
+// allocate nothing of their own, and session backlogs and stream buffers
+// are fixed tables (MAX_PLAYERS seats, FD_SETSIZE connections) that live
+// as long as the process.
+#define     ARENA_CHUNK_SIZE        (64ul << 10)
+
+typedef struct arena_chunk_s arena_chunk_t;
+
+typedef struct arena_s
+{
+    memory_subsystem_t  subsystem;
+    arena_chunk_t      *chunks;
+    size_t              used;
+} arena_t;
+
+void arena_init(arena_t *arena, memory_subsystem_t subsystem);
+// Aligned for any type, NULL past the budget
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_release(arena_t *arena);
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packet.h"
+
+// Persistent leaderboard keyed by player name. The game loop owns the
+// in-memory table and its rank index and only hands results to a writer
+// thread, which appends them to a write-ahead log in batches (one write and
+// one fdatasync per batch) and folds the log into a snapshot once it grows.
+// Every log record carries a sequence number and the snapshot the last one
+// it contains, so a crash between the two steps replays nothing twice.
+
+#define     LEADERBOARD_COMPACT_RECORDS     1024
+#define     SKIPLIST_MAX_LEVEL              16
+
+// One finished race of one player. wpm is in hundredths
+typedef struct leaderboard_result_s
+{
+    char        name[MAX_PLAYER_NAME_SIZE];
+    uint32_t    wpm;
+    uint32_t    words;
+    uint32_t    keys;
+    uint32_t    errors;
+    uint32_t    won;
+} leaderboard_result_t;
+
+typedef struct leaderboard_entry_s
+{
+    char        name[MAX_PLAYER_NAME_SIZE];
+    uint32_t    races;
+    uint32_t    wins;
+    uint32_t    words;
+    uint32_t    best_wpm;
+    uint32_t    last_wpm;
+    uint64_t    keys;
+    uint64_t    errors;
+} leaderboard_entry_t;
+
+// Entries by name: open addressing over indexes into a growing array
+typedef struct leaderboard_table_s
+{
+    leaderboard_entry_t    *entries;
+    uint32_t                count;
+    uint32_t                capacity;
+    uint32_t               *slots;
+    uint32_t                slot_mask;
+} leaderboard_table_t;
+
+// Indexable skip list ordered by best WPM: each link knows how many entries
+// it jumps over, which gives rank and n-th lookups in O(log n)
+typedef struct skiplist_node_s skiplist_node_t;
+
+typedef struct skiplist_link_s
+{
+    skiplist_node_t    *next;
+    uint32_t            span;
+} skiplist_link_t;
+
+struct skiplist_node_s
+{
+    uint32_t            entry;
+    int                 level;
+    skiplist_link_t     links[];
+};
+
+typedef struct skiplist_s
+{
+    skiplist_node_t    *head;
+    int                 level;
+    uint32_t            length;
+    uint32_t            seed;
+} skiplist_t;
+
+typedef struct leaderboard_s
+{
+    leaderboard_table_t     table;
+    skiplist_t              index;
+    skiplist_node_t       **nodes;
+    uint64_t                lsn;
+    char                   *dir;
+    int                     wal;
+    // Shared with the writer thread
+    pthread_t               thread;
+    pthread_mutex_t         lock;
+    pthread_cond_t          wake;
+    int                     stopping;
+    struct leaderboard_record_s *pending;
+    size_t                  pending_count;
+    size_t                  pending_capacity;
+} leaderboard_t;
+
+int leaderboard_open(leaderboard_t *board, const char *dir);
+void leaderboard_close(leaderboard_t *board);
+// Applies in memory and queues the log write, never touches the disk
+void leaderboard_record(leaderboard_t *board, const leaderboard_result_t *result);
+// Up to count entries from the top, rank of entry i is i + 1
+size_t leaderboard_top(const leaderboard_t *board, const leaderboard_entry_t **out, size_t count);
+// 1-based rank of a player, 0 if unknown
+uint32_t leaderboard_rank(const leaderboard_t *board, const char name[MAX_PLAYER_NAME_SIZE], const leaderboard_entry_t **entry);
+
+static inline uint32_t leaderboard_size(const leaderboard_t *board) {
+    return board->table.count;
+}
+
+// Hundredths of a percent of keystrokes that were right
+static inline uint32_t leaderboard_accuracy(const leaderboard_entry_t *entry) {
+    return entry->keys == 0 ? 0 : (entry->keys - entry->errors) * 10000 / entry->keys;
+}
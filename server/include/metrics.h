@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "packet.h"
+
+// Log-linear (HDR style) histogram: 16 linear sub-buckets per power of two,
+// which keeps the relative error under ~6% for any recorded value.
+#define     HIST_SUB_BITS       4
+#define     HIST_SUB_COUNT      (1 << HIST_SUB_BITS)
+#define     HIST_BUCKETS        ((32 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct histogram_s
+{
+    uint64_t    count;
+    uint64_t    sum;
+    uint32_t    max;
+    uint64_t    buckets[HIST_BUCKETS];
+} histogram_t;
+
+#define     METRICS_PACKET_TYPES    32
+
+typedef struct metrics_s
+{
+    uint64_t    connections;
+    uint64_t    rooms_started;
+    uint64_t    rooms_ended;
+    uint64_t    broken_sockets;
+    uint64_t    evictions;
+    uint64_t    protocol_errors;
+    uint64_t    sessions_resumed;
+    uint64_t    syscalls;
+    uint64_t    words_completed;
+    uint64_t    completions_flagged;
+    uint64_t    datagrams_stale;
+    uint64_t    datagrams_rejected;
+    uint64_t    packets_in[METRICS_PACKET_TYPES];
+    uint64_t    bytes_in[METRICS_PACKET_TYPES];
+    uint64_t    packets_out[METRICS_PACKET_TYPES];
+    uint64_t    bytes_out[METRICS_PACKET_TYPES];
+    histogram_t loop_busy_ns;
+    histogram_t word_latency_us;
+    histogram_t outq_bytes;
+    histogram_t rtt_us;
+    histogram_t typing_wpm;
+    histogram_t typing_bigram_ms;
+} metrics_t;
+
+extern metrics_t METRICS;
+
+static inline int64_t clock_now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static inline int histogram_index(uint32_t value) {
+    int shift;
+
+    if (value < HIST_SUB_COUNT)
+        return value;
+    shift = 31 - __builtin_clz(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + ((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+static inline void histogram_record(histogram_t *hist, uint64_t value) {
+    uint32_t v = value > UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+
+    hist->count++;
+    hist->sum += v;
+    if (v > hist->max)
+        hist->max = v;
+    hist->buckets[histogram_index(v)]++;
+}
+
+static inline void metrics_packet_in(packet_type_t type, uint64_t bytes) {
+    unsigned idx = (unsigned)type < METRICS_PACKET_TYPES ? (unsigned)type : 0;
+
+    METRICS.packets_in[idx]++;
+    METRICS.bytes_in[idx] += bytes;
+}
+
+static inline void metrics_packet_out(packet_type_t type, uint64_t bytes) {
+    unsigned idx = (unsigned)type < METRICS_PACKET_TYPES ? (unsigned)type : 0;
+
+    METRICS.packets_out[idx]++;
+    METRICS.bytes_out[idx] += bytes;
+}
+
+uint32_t histogram_percentile(const histogram_t *hist, double percentile);
+
+// Admin socket: every connection receives one text snapshot then is closed
+int admin_init(const char *path);
+void admin_serve(int client);
+void admin_destroy(const char *path);
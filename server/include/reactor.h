@@ -0,0 +1,103 @@
+#pragma once
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Event loop abstraction: the game only sees accepted sockets, received
+// bytes and send failures, whichever kernel interface produces them
+
+typedef struct reactor_handler_s
+{
+    void    *ctx;
+    // A listener produced a new connection
+    void    (*accept)(void *ctx, int listener, int socket);
+    // Bytes received on a watched socket, size 0 on EOF and < 0 on error
+    void    (*data)(void *ctx, int socket, const char *data, ssize_t size);
+    // A queued send failed after reactor_send had already returned
+    void    (*send_error)(void *ctx, int socket);
+    // A polled socket has data, the handler reads it itself
+    void    (*readable)(void *ctx, int socket);
+} reactor_handler_t;
+
+typedef struct reactor_s reactor_t;
+
+typedef struct reactor_backend_s
+{
+    const char  *name;
+    int         (*init)(reactor_t *reactor);
+    void        (*destroy)(reactor_t *reactor);
+    int         (*listen)(reactor_t *reactor, int socket);
+    int         (*watch)(reactor_t *reactor, int socket);
+    int         (*poll)(reactor_t *reactor, int socket);
+    void        (*unwatch)(reactor_t *reactor, int socket);
+    ssize_t     (*send)(reactor_t *reactor, int socket, const void *data, size_t size);
+    int         (*wait)(reactor_t *reactor, const struct timespec *timeout, const sigset_t *sigset);
+    void        (*flush)(reactor_t *reactor);
+    void        (*quiesce)(reactor_t *reactor);
+    void        (*resume)(reactor_t *reactor);
+} reactor_backend_t;
+
+struct reactor_s
+{
+    const reactor_backend_t    *backend;
+    reactor_handler_t           handler;
+    void                       *impl;
+    // When the last wait returned, before its events were dispatched
+    int64_t                     woke;
+};
+
+extern const reactor_backend_t REACTOR_SELECT;
+extern const reactor_backend_t REACTOR_URING;
+
+int reactor_init(reactor_t *reactor, const char *backend, reactor_handler_t handler);
+
+static inline void reactor_destroy(reactor_t *reactor) {
+    reactor->backend->destroy(reactor);
+}
+
+// Accept connections on a listening socket
+static inline int reactor_listen(reactor_t *reactor, int socket) {
+    return reactor->backend->listen(reactor, socket);
+}
+
+// Start receiving on a connected socket
+static inline int reactor_watch(reactor_t *reactor, int socket) {
+    return reactor->backend->watch(reactor, socket);
+}
+
+// Only report readiness, for sockets that need recvfrom (datagrams)
+static inline int reactor_poll(reactor_t *reactor, int socket) {
+    return reactor->backend->poll(reactor, socket);
+}
+
+// Stop watching and close, anything already queued is still sent
+void reactor_close(reactor_t *reactor, int socket);
+
+// Queue bytes for a watched socket, < 0 if they cannot be sent
+static inline ssize_t reactor_send(reactor_t *reactor, int socket, const void *data, size_t size) {
+    return reactor->backend->send(reactor, socket, data, size);
+}
+
+// Block until events or timeout and dispatch them, < 0 on error
+static inline int reactor_wait(reactor_t *reactor, const struct timespec *timeout, const sigset_t *sigset) {
+    return reactor->backend->wait(reactor, timeout, sigset);
+}
+
+// End of a loop iteration: hand every queued send to the kernel
+static inline void reactor_flush(reactor_t *reactor) {
+    reactor->backend->flush(reactor);
+}
+
+// Stops accepting and receiving everywhere, dispatches whatever the kernel
+// had already received for us and returns once every queued send left.
+// Descriptors stay open: unread bytes wait in their socket for whoever
+// reads next, this process after reactor_resume or another one.
+static inline void reactor_quiesce(reactor_t *reactor) {
+    reactor->backend->quiesce(reactor);
+}
+
+static inline void reactor_resume(reactor_t *reactor) {
+    reactor->backend->resume(reactor);
+}
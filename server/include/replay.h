@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packet.h"
+
+// Race logs: a header, append-only records stamped relative to the race
+// start, a keyframe holding the whole room every REPLAY_KEYFRAME_INTERVAL,
+// and a footer indexing the keyframes so any instant is one binary search
+// away. A log cut short by a crash has no footer: the reader rebuilds the
+// index by scanning.
+
+#define     REPLAY_MAGIC                0x474c5254  // "TRLG"
+#define     REPLAY_INDEX_MAGIC          0x58495254  // "TRIX"
+#define     REPLAY_VERSION              1
+#define     REPLAY_MAX_PLAYERS          8
+#define     REPLAY_PAUSED               UINT32_MAX
+#define     REPLAY_KEYFRAME_INTERVAL    1000000000ll
+
+typedef enum replay_type_e {
+    REPLAY_KEYFRAME     =   0x01,
+    REPLAY_STATUS       =   0x02,
+    REPLAY_JOIN         =   0x03,
+    REPLAY_REMOVE       =   0x04,
+    REPLAY_WORD         =   0x05,
+    REPLAY_COMPLETE     =   0x06,
+} replay_type_t;
+
+typedef struct replay_player_s
+{
+    int32_t     player_id;
+    int32_t     score;
+    char        name[MAX_PLAYER_NAME_SIZE];
+} replay_player_t;
+
+// remain_ms is REPLAY_PAUSED when the room has no deadline
+typedef struct replay_status_s
+{
+    uint8_t     state;
+    uint32_t    remain_ms;
+} replay_status_t;
+
+typedef struct replay_event_s
+{
+    replay_type_t   type;
+    uint32_t        time_us;
+    replay_status_t status;         // KEYFRAME, STATUS
+    replay_player_t player;         // JOIN, REMOVE (id), COMPLETE (id, score)
+    packet_string_t word;           // WORD (player.player_id)
+    int             count;          // KEYFRAME
+    replay_player_t players[REPLAY_MAX_PLAYERS];
+} replay_event_t;
+
+typedef struct replay_index_s
+{
+    uint32_t    time_us;
+    uint32_t    offset;
+} replay_index_t;
+
+
+
+/////////// WRITER ////////////
+
+// Records are copied into a growing shared mapping of the file: appending
+// is a memcpy and the page cache writes back on its own
+typedef struct replay_writer_s
+{
+    int             fd;
+    char           *map;
+    size_t          size;
+    size_t          length;
+    int64_t         start;
+    int64_t         next_keyframe;
+    replay_index_t *index;
+    size_t          index_count;
+    size_t          index_capacity;
+} replay_writer_t;
+
+int replay_writer_open(replay_writer_t *writer, const char *path, int64_t start);
+void replay_writer_close(replay_writer_t *writer);
+void replay_write_status(replay_writer_t *writer, int64_t now, game_state_t state, int64_t deadline);
+void replay_write_player(replay_writer_t *writer, int64_t now, replay_type_t type, const replay_player_t *player);
+void replay_write_word(replay_writer_t *writer, int64_t now, int player_id, const char *word);
+void replay_write_keyframe(replay_writer_t *writer, int64_t now, game_state_t state, int64_t deadline,
+    const replay_player_t *players, int count);
+
+static inline int replay_keyframe_due(const replay_writer_t *writer, int64_t now) {
+    return writer->map != NULL && now >= writer->next_keyframe;
+}
+
+
+
+/////////// READER ////////////
+
+typedef struct replay_reader_s
+{
+    int             fd;
+    const char     *map;
+    size_t          size;
+    size_t          end;
+    size_t          cursor;
+    replay_index_t *index;
+    size_t          index_count;
+    size_t          index_capacity;
+    uint32_t        duration_us;
+} replay_reader_t;
+
+int replay_reader_open(replay_reader_t *reader, const char *path);
+void replay_reader_close(replay_reader_t *reader);
+// 1 with the next event, 0 at the end of the log
+int replay_next(replay_reader_t *reader, replay_event_t *event);
+// Positions on the last keyframe at or before time_us, whose event is next
+void replay_seek(replay_reader_t *reader, uint32_t time_us);
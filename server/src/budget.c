@@ -0,0 +1,118 @@
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "budget.h"
+
+memory_budget_t MEMORY = {.limit=MEMORY_DEFAULT_BUDGET};
+
+const char *const MEMORY_SUBSYSTEMS[MEM_SUBSYSTEMS] = {
+    [MEM_WORDS]         = "words",
+    [MEM_NETWORK]       = "network",
+    [MEM_REPLAY]        = "replay",
+    [MEM_PLAYBACK]      = "playback",
+    [MEM_LEADERBOARD]   = "leaderboard",
+};
+
+
+
+/////////// BUDGET ////////////
+
+int mem_charge(memory_subsystem_t subsystem, size_t size) {
+    size_t total = __atomic_add_fetch(&MEMORY.total, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&MEMORY.peak, __ATOMIC_RELAXED);
+
+    if (total > MEMORY.limit) {
+        __atomic_sub_fetch(&MEMORY.total, size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&MEMORY.refused, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    __atomic_add_fetch(&MEMORY.used[subsystem], size, __ATOMIC_RELAXED);
+    while (total > peak && !__atomic_compare_exchange_n(&MEMORY.peak, &peak, total, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    return 0;
+}
+
+void mem_discharge(memory_subsystem_t subsystem, size_t size) {
+    __atomic_sub_fetch(&MEMORY.used[subsystem], size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&MEMORY.total, size, __ATOMIC_RELAXED);
+}
+
+void *mem_alloc(memory_subsystem_t subsystem, size_t size) {
+    void *ptr;
+
+    if (mem_charge(subsystem, size) < 0)
+        return NULL;
+    if ((ptr = calloc(1, size)) == NULL)
+        mem_discharge(subsystem, size);
+    return ptr;
+}
+
+void *mem_realloc(memory_subsystem_t subsystem, void *ptr, size_t old_size, size_t size) {
+    void *grown;
+
+    if (size > old_size && mem_charge(subsystem, size - old_size) < 0)
+        return NULL;
+    if ((grown = realloc(ptr, size)) == NULL) {
+        if (size > old_size)
+            mem_discharge(subsystem, size - old_size);
+        return NULL;
+    }
+    if (size < old_size)
+        mem_discharge(subsystem, old_size - size);
+    return grown;
+}
+
+void mem_free(memory_subsystem_t subsystem, void *ptr, size_t size) {
+    if (ptr == NULL)
+        return;
+    free(ptr);
+    mem_discharge(subsystem, size);
+}
+
+
+
+/////////// ARENA ////////////
+
+struct arena_chunk_s
+{
+    arena_chunk_t  *next;
+    size_t          size;
+    alignas(max_align_t) char data[];
+};
+
+void arena_init(arena_t *arena, memory_subsystem_t subsystem) {
+    *arena = (arena_t){.subsystem=subsystem};
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_chunk_t *chunk = arena->chunks;
+    size_t chunk_size;
+    void *ptr;
+
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+    if (chunk == NULL || arena->used + size > chunk->size) {
+        // Oversized requests get a chunk of their own
+        chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        if ((chunk = mem_alloc(arena->subsystem, sizeof(arena_chunk_t) + chunk_size)) == NULL)
+            return NULL;
+        chunk->size = chunk_size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->used = 0;
+    }
+    ptr = chunk->data + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+void arena_release(arena_t *arena) {
+    arena_chunk_t *next;
+
+    for (arena_chunk_t *chunk = arena->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        mem_free(arena->subsystem, chunk, sizeof(arena_chunk_t) + chunk->size);
+    }
+    arena->chunks = NULL;
+    arena->used = 0;
+}
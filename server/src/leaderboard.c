@@ -0,0 +1,555 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "budget.h"
+#include "leaderboard.h"
+
+#define     LEADERBOARD_MAGIC       0x424c5254  // "TRLB"
+#define     LEADERBOARD_VERSION     1
+#define     SNAPSHOT_FILE           "leaderboard.db"
+#define     WAL_FILE                "leaderboard.wal"
+
+typedef struct leaderboard_record_s
+{
+    uint64_t                lsn;
+    leaderboard_result_t    result;
+    uint32_t                checksum;
+} leaderboard_record_t;
+
+typedef struct snapshot_header_s
+{
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    count;
+    uint32_t    checksum;
+    uint64_t    lsn;
+} snapshot_header_t;
+
+static uint32_t fnv1a(const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+static uint32_t record_checksum(const leaderboard_record_t *record) {
+    return fnv1a(record, offsetof(leaderboard_record_t, checksum));
+}
+
+static int leaderboard_path(char path[PATH_MAX], const char *dir, const char *file) {
+    if (snprintf(path, PATH_MAX, "%s/%s", dir, file) >= PATH_MAX) {
+        fprintf(stderr, "[ERROR] Leaderboard path too long: %s\n", dir);
+        return -1;
+    }
+    return 0;
+}
+
+
+
+/////////// TABLE ////////////
+
+static void table_destroy(leaderboard_table_t *table) {
+    mem_free(MEM_LEADERBOARD, table->entries, table->capacity * sizeof(leaderboard_entry_t));
+    if (table->slots != NULL)
+        mem_free(MEM_LEADERBOARD, table->slots, (table->slot_mask + 1) * sizeof(uint32_t));
+    *table = (leaderboard_table_t){0};
+}
+
+static uint32_t *table_slot(const leaderboard_table_t *table, const char name[MAX_PLAYER_NAME_SIZE]) {
+    uint32_t slot = fnv1a(name, strnlen(name, MAX_PLAYER_NAME_SIZE)) & table->slot_mask;
+
+    // Slots hold entry + 1, 0 is free
+    while (table->slots[slot] != 0
+        && strncmp(table->entries[table->slots[slot] - 1].name, name, MAX_PLAYER_NAME_SIZE) != 0)
+        slot = (slot + 1) & table->slot_mask;
+    return table->slots + slot;
+}
+
+static int table_rehash(leaderboard_table_t *table, uint32_t slots) {
+    uint32_t *old = table->slots;
+    size_t old_size = old != NULL ? (table->slot_mask + 1) * sizeof(uint32_t) : 0;
+
+    if ((table->slots = mem_alloc(MEM_LEADERBOARD, slots * sizeof(uint32_t))) == NULL) {
+        table->slots = old;
+        return -1;
+    }
+    table->slot_mask = slots - 1;
+    for (uint32_t i = 0; i < table->count; ++i)
+        *table_slot(table, table->entries[i].name) = i + 1;
+    mem_free(MEM_LEADERBOARD, old, old_size);
+    return 0;
+}
+
+static int table_find(const leaderboard_table_t *table, const char name[MAX_PLAYER_NAME_SIZE]) {
+    if (table->slots == NULL)
+        return -1;
+    return (int)*table_slot(table, name) - 1;
+}
+
+// Index of the player's entry, created empty on first sight
+static int table_upsert(leaderboard_table_t *table, const char name[MAX_PLAYER_NAME_SIZE]) {
+    leaderboard_entry_t *entries;
+    int idx = table_find(table, name);
+    uint32_t grown;
+
+    if (idx != -1)
+        return idx;
+    if (table->count == table->capacity) {
+        grown = table->capacity ? table->capacity * 2 : 64;
+        if ((entries = mem_realloc(MEM_LEADERBOARD, table->entries, table->capacity * sizeof(leaderboard_entry_t),
+            grown * sizeof(leaderboard_entry_t))) == NULL)
+            return -1;
+        table->entries = entries;
+        table->capacity = grown;
+    }
+    // Load factor under one half
+    if ((table->count + 1) * 2 > table->slot_mask + 1 && table_rehash(table, table->slots ? (table->slot_mask + 1) * 2 : 128) < 0)
+        return -1;
+    table->entries[table->count] = (leaderboard_entry_t){0};
+    strncpy(table->entries[table->count].name, name, MAX_PLAYER_NAME_SIZE);
+    *table_slot(table, name) = table->count + 1;
+    return table->count++;
+}
+
+static void table_apply(leaderboard_entry_t *entry, const leaderboard_result_t *result) {
+    entry->races++;
+    entry->wins += result->won != 0;
+    entry->words += result->words;
+    entry->keys += result->keys;
+    entry->errors += result->errors < result->keys ? result->errors : result->keys;
+    entry->last_wpm = result->wpm;
+    if (result->wpm > entry->best_wpm)
+        entry->best_wpm = result->wpm;
+}
+
+
+
+/////////// SKIP LIST ////////////
+
+static size_t skiplist_node_size(int level) {
+    return sizeof(skiplist_node_t) + level * sizeof(skiplist_link_t);
+}
+
+static skiplist_node_t *skiplist_node(uint32_t entry, int level) {
+    skiplist_node_t *node = mem_alloc(MEM_LEADERBOARD, skiplist_node_size(level));
+
+    if (node != NULL) {
+        node->entry = entry;
+        node->level = level;
+    }
+    return node;
+}
+
+static int skiplist_init(skiplist_t *list) {
+    if ((list->head = skiplist_node(UINT32_MAX, SKIPLIST_MAX_LEVEL)) == NULL)
+        return -1;
+    list->level = 1;
+    list->length = 0;
+    list->seed = 2463534242u;
+    return 0;
+}
+
+static void skiplist_destroy(skiplist_t *list) {
+    skiplist_node_t *node = list->head;
+    skiplist_node_t *next;
+
+    while (node != NULL) {
+        next = node->links[0].next;
+        mem_free(MEM_LEADERBOARD, node, skiplist_node_size(node->level));
+        node = next;
+    }
+    list->head = NULL;
+}
+
+// One level up with probability 1/4
+static int skiplist_level(skiplist_t *list) {
+    int level = 1;
+
+    list->seed ^= list->seed << 13;
+    list->seed ^= list->seed >> 17;
+    list->seed ^= list->seed << 5;
+    for (uint32_t bits = list->seed; (bits & 3) == 0 && level < SKIPLIST_MAX_LEVEL; bits >>= 2)
+        level++;
+    return level;
+}
+
+// Best WPM first, then by name so every entry has a single place
+static int skiplist_before(const leaderboard_table_t *table, uint32_t a, uint32_t b) {
+    const leaderboard_entry_t *x = table->entries + a;
+    const leaderboard_entry_t *y = table->entries + b;
+
+    if (x->best_wpm != y->best_wpm)
+        return x->best_wpm > y->best_wpm;
+    return strncmp(x->name, y->name, MAX_PLAYER_NAME_SIZE) < 0;
+}
+
+static skiplist_node_t *skiplist_insert(skiplist_t *list, const leaderboard_table_t *table, uint32_t entry) {
+    skiplist_node_t *update[SKIPLIST_MAX_LEVEL];
+    uint32_t rank[SKIPLIST_MAX_LEVEL];
+    skiplist_node_t *node = list->head;
+    int level = skiplist_level(list);
+
+    for (int i = list->level - 1; i >= 0; --i) {
+        rank[i] = i == list->level - 1 ? 0 : rank[i + 1];
+        while (node->links[i].next != NULL && skiplist_before(table, node->links[i].next->entry, entry)) {
+            rank[i] += node->links[i].span;
+            node = node->links[i].next;
+        }
+        update[i] = node;
+    }
+    if (level > list->level) {
+        for (int i = list->level; i < level; ++i) {
+            rank[i] = 0;
+            update[i] = list->head;
+            update[i]->links[i].span = list->length;
+        }
+        list->level = level;
+    }
+    if ((node = skiplist_node(entry, level)) == NULL)
+        return NULL;
+    for (int i = 0; i < level; ++i) {
+        node->links[i].next = update[i]->links[i].next;
+        update[i]->links[i].next = node;
+        node->links[i].span = update[i]->links[i].span - (rank[0] - rank[i]);
+        update[i]->links[i].span = rank[0] - rank[i] + 1;
+    }
+    for (int i = level; i < list->level; ++i)
+        update[i]->links[i].span++;
+    list->length++;
+    return node;
+}
+
+// The entry must still hold the key it was inserted with
+static void skiplist_remove(skiplist_t *list, const leaderboard_table_t *table, skiplist_node_t *target) {
+    skiplist_node_t *update[SKIPLIST_MAX_LEVEL];
+    skiplist_node_t *node = list->head;
+
+    for (int i = list->level - 1; i >= 0; --i) {
+        while (node->links[i].next != NULL && node->links[i].next != target
+            && skiplist_before(table, node->links[i].next->entry, target->entry))
+            node = node->links[i].next;
+        update[i] = node;
+    }
+    for (int i = 0; i < list->level; ++i) {
+        if (update[i]->links[i].next == target) {
+            update[i]->links[i].span += target->links[i].span - 1;
+            update[i]->links[i].next = target->links[i].next;
+        } else
+            update[i]->links[i].span--;
+    }
+    while (list->level > 1 && list->head->links[list->level - 1].next == NULL)
+        list->level--;
+    list->length--;
+    mem_free(MEM_LEADERBOARD, target, skiplist_node_size(target->level));
+}
+
+static uint32_t skiplist_rank(const skiplist_t *list, const leaderboard_table_t *table, const skiplist_node_t *target) {
+    const skiplist_node_t *node = list->head;
+    uint32_t rank = 0;
+
+    for (int i = list->level - 1; i >= 0; --i) {
+        while (node->links[i].next != NULL && (node->links[i].next == target
+            || skiplist_before(table, node->links[i].next->entry, target->entry))) {
+            rank += node->links[i].span;
+            node = node->links[i].next;
+        }
+        if (node == target)
+            return rank;
+    }
+    return 0;
+}
+
+
+
+/////////// FILES ////////////
+
+static int snapshot_load(const char *path, leaderboard_table_t *table, uint64_t *lsn) {
+    snapshot_header_t header;
+    leaderboard_entry_t *entries;
+    size_t size;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int idx;
+
+    if (fd < 0)
+        return 0;
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || header.magic != LEADERBOARD_MAGIC
+        || header.version != LEADERBOARD_VERSION) {
+        fprintf(stderr, "[ERROR] Ignoring unreadable leaderboard snapshot: %s\n", path);
+        close(fd);
+        return -1;
+    }
+    size = (size_t)header.count * sizeof(leaderboard_entry_t) + 1;
+    if ((entries = mem_alloc(MEM_LEADERBOARD, size)) == NULL) {
+        close(fd);
+        return -1;
+    }
+    if (read(fd, entries, header.count * sizeof(leaderboard_entry_t)) != (ssize_t)(header.count * sizeof(leaderboard_entry_t))
+        || fnv1a(entries, header.count * sizeof(leaderboard_entry_t)) != header.checksum) {
+        fprintf(stderr, "[ERROR] Corrupted leaderboard snapshot: %s\n", path);
+        mem_free(MEM_LEADERBOARD, entries, size);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    for (uint32_t i = 0; i < header.count; ++i)
+        if ((idx = table_upsert(table, entries[i].name)) != -1)
+            table->entries[idx] = entries[i];
+    mem_free(MEM_LEADERBOARD, entries, size);
+    *lsn = header.lsn;
+    return 0;
+}
+
+// Replays the log past the snapshot. Returns the end of the last intact
+// record: anything after it is a torn write
+static off_t wal_replay(int fd, leaderboard_table_t *table, uint64_t *lsn) {
+    leaderboard_record_t record;
+    off_t good = 0;
+    int idx;
+
+    lseek(fd, 0, SEEK_SET);
+    while (read(fd, &record, sizeof(record)) == sizeof(record) && record.checksum == record_checksum(&record)) {
+        good += sizeof(record);
+        if (record.lsn <= *lsn)
+            continue;
+        *lsn = record.lsn;
+        if ((idx = table_upsert(table, record.result.name)) != -1)
+            table_apply(table->entries + idx, &record.result);
+    }
+    return good;
+}
+
+static int snapshot_write(const char *dir, const leaderboard_table_t *table, uint64_t lsn) {
+    snapshot_header_t header = {
+        .magic=LEADERBOARD_MAGIC,
+        .version=LEADERBOARD_VERSION,
+        .count=table->count,
+        .checksum=fnv1a(table->entries, table->count * sizeof(leaderboard_entry_t)),
+        .lsn=lsn
+    };
+    char tmp[PATH_MAX];
+    char path[PATH_MAX];
+    int fd = -1;
+    int ret = -1;
+
+    if (leaderboard_path(tmp, dir, SNAPSHOT_FILE ".tmp") == 0 && leaderboard_path(path, dir, SNAPSHOT_FILE) == 0)
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd >= 0 && write(fd, &header, sizeof(header)) == sizeof(header)
+        && write(fd, table->entries, table->count * sizeof(leaderboard_entry_t)) == (ssize_t)(table->count * sizeof(leaderboard_entry_t))
+        && fsync(fd) == 0 && rename(tmp, path) == 0)
+        ret = 0;
+    else
+        perror("leaderboard snapshot");
+    if (fd >= 0)
+        close(fd);
+    return ret;
+}
+
+// Runs on the writer thread: rebuilds the table from disk rather than
+// sharing the game loop's copy, then starts a fresh log
+static void leaderboard_compact(leaderboard_t *board) {
+    leaderboard_table_t table = {0};
+    char path[PATH_MAX];
+    uint64_t lsn = 0;
+
+    if (leaderboard_path(path, board->dir, SNAPSHOT_FILE) < 0)
+        return;
+    snapshot_load(path, &table, &lsn);
+    wal_replay(board->wal, &table, &lsn);
+    if (snapshot_write(board->dir, &table, lsn) == 0 && ftruncate(board->wal, 0) == 0 && lseek(board->wal, 0, SEEK_SET) == 0)
+        printf("[INFO] Leaderboard compacted: %u players up to record %lu\n", table.count, lsn);
+    table_destroy(&table);
+}
+
+
+
+/////////// WRITER ////////////
+
+static void *leaderboard_writer(void *arg) {
+    leaderboard_t *board = arg;
+    leaderboard_record_t *batch = NULL;
+    size_t batch_capacity = 0;
+    size_t count;
+    off_t logged;
+    int stopping;
+
+    for (;;) {
+        pthread_mutex_lock(&board->lock);
+        while (board->pending_count == 0 && !board->stopping)
+            pthread_cond_wait(&board->wake, &board->lock);
+        // Swap buffers: the game loop keeps queueing while we write
+        leaderboard_record_t *swap = board->pending;
+        size_t swap_capacity = board->pending_capacity;
+
+        count = board->pending_count;
+        board->pending = batch;
+        board->pending_capacity = batch_capacity;
+        board->pending_count = 0;
+        batch = swap;
+        batch_capacity = swap_capacity;
+        stopping = board->stopping;
+        pthread_mutex_unlock(&board->lock);
+
+        if (count > 0) {
+            if (write(board->wal, batch, count * sizeof(leaderboard_record_t)) != (ssize_t)(count * sizeof(leaderboard_record_t))
+                || fdatasync(board->wal) < 0)
+                perror("leaderboard wal");
+        }
+        // Records left over by a previous run count as well
+        logged = lseek(board->wal, 0, SEEK_CUR) / (off_t)sizeof(leaderboard_record_t);
+        if (logged >= LEADERBOARD_COMPACT_RECORDS || (stopping && logged > 0))
+            leaderboard_compact(board);
+        if (stopping)
+            break;
+    }
+    mem_free(MEM_LEADERBOARD, batch, batch_capacity * sizeof(leaderboard_record_t));
+    return NULL;
+}
+
+
+
+/////////// LEADERBOARD ////////////
+
+// Rows of the entry -> node index, which always has one
+static size_t nodes_size(uint32_t capacity) {
+    return (capacity ? capacity : 1) * sizeof(skiplist_node_t *);
+}
+
+int leaderboard_open(leaderboard_t *board, const char *dir) {
+    char snapshot[PATH_MAX];
+    char wal[PATH_MAX];
+    size_t dir_size = strlen(dir) + 1;
+    off_t good;
+
+    *board = (leaderboard_t){.wal=-1};
+    if (leaderboard_path(snapshot, dir, SNAPSHOT_FILE) < 0 || leaderboard_path(wal, dir, WAL_FILE) < 0)
+        return -1;
+    if ((board->dir = mem_alloc(MEM_LEADERBOARD, dir_size)) == NULL || skiplist_init(&board->index) < 0) {
+        fprintf(stderr, "[ERROR] No memory left for the leaderboard\n");
+        goto fail;
+    }
+    memcpy(board->dir, dir, dir_size);
+    mkdir(dir, 0755);
+    snapshot_load(snapshot, &board->table, &board->lsn);
+    if ((board->wal = open(wal, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+        perror(wal);
+        goto fail;
+    }
+    good = wal_replay(board->wal, &board->table, &board->lsn);
+    if (ftruncate(board->wal, good) < 0 || lseek(board->wal, good, SEEK_SET) < 0) {
+        perror(wal);
+        goto fail;
+    }
+    if ((board->nodes = mem_alloc(MEM_LEADERBOARD, nodes_size(board->table.capacity))) == NULL)
+        goto fail;
+    for (uint32_t i = 0; i < board->table.count; ++i)
+        board->nodes[i] = skiplist_insert(&board->index, &board->table, i);
+    pthread_mutex_init(&board->lock, NULL);
+    pthread_cond_init(&board->wake, NULL);
+    if (pthread_create(&board->thread, NULL, leaderboard_writer, board) != 0) {
+        perror("pthread_create");
+        goto fail;
+    }
+    printf("[INFO] Leaderboard loaded: %u players from %s\n", board->table.count, dir);
+    return 0;
+
+fail:
+    if (board->wal >= 0)
+        close(board->wal);
+    skiplist_destroy(&board->index);
+    mem_free(MEM_LEADERBOARD, board->nodes, nodes_size(board->table.capacity));
+    table_destroy(&board->table);
+    mem_free(MEM_LEADERBOARD, board->dir, dir_size);
+    *board = (leaderboard_t){.wal=-1};
+    return -1;
+}
+
+// Drains the queue, compacts and stops the writer
+void leaderboard_close(leaderboard_t *board) {
+    if (board->wal < 0)
+        return;
+    pthread_mutex_lock(&board->lock);
+    board->stopping = 1;
+    pthread_cond_signal(&board->wake);
+    pthread_mutex_unlock(&board->lock);
+    pthread_join(board->thread, NULL);
+    pthread_mutex_destroy(&board->lock);
+    pthread_cond_destroy(&board->wake);
+    close(board->wal);
+    skiplist_destroy(&board->index);
+    mem_free(MEM_LEADERBOARD, board->nodes, nodes_size(board->table.capacity));
+    mem_free(MEM_LEADERBOARD, board->pending, board->pending_capacity * sizeof(leaderboard_record_t));
+    table_destroy(&board->table);
+    mem_free(MEM_LEADERBOARD, board->dir, strlen(board->dir) + 1);
+    *board = (leaderboard_t){.wal=-1};
+}
+
+void leaderboard_record(leaderboard_t *board, const leaderboard_result_t *result) {
+    leaderboard_record_t record = {.lsn=board->lsn + 1, .result=*result};
+    skiplist_node_t **nodes;
+    uint32_t capacity = board->table.capacity;
+    int idx;
+
+    if (board->wal < 0 || (idx = table_upsert(&board->table, result->name)) == -1)
+        return;
+    if (board->table.capacity != capacity) {
+        if ((nodes = mem_realloc(MEM_LEADERBOARD, board->nodes, nodes_size(capacity), nodes_size(board->table.capacity))) == NULL)
+            return;
+        board->nodes = nodes;
+        memset(nodes + capacity, 0, (board->table.capacity - capacity) * sizeof(skiplist_node_t *));
+    }
+    // Re-keyed entries leave the index before their key changes
+    if (board->nodes[idx] != NULL)
+        skiplist_remove(&board->index, &board->table, board->nodes[idx]);
+    table_apply(board->table.entries + idx, result);
+    board->nodes[idx] = skiplist_insert(&board->index, &board->table, idx);
+
+    record.checksum = record_checksum(&record);
+    board->lsn = record.lsn;
+    pthread_mutex_lock(&board->lock);
+    if (board->pending_count == board->pending_capacity) {
+        size_t grown = board->pending_capacity ? board->pending_capacity * 2 : 64;
+        leaderboard_record_t *pending = mem_realloc(MEM_LEADERBOARD, board->pending,
+            board->pending_capacity * sizeof(leaderboard_record_t), grown * sizeof(leaderboard_record_t));
+
+        if (pending == NULL) {
+            pthread_mutex_unlock(&board->lock);
+            fprintf(stderr, "[ERROR] Leaderboard queue full, result of %.*s dropped\n", MAX_PLAYER_NAME_SIZE, result->name);
+            return;
+        }
+        board->pending = pending;
+        board->pending_capacity = grown;
+    }
+    board->pending[board->pending_count++] = record;
+    pthread_cond_signal(&board->wake);
+    pthread_mutex_unlock(&board->lock);
+}
+
+size_t leaderboard_top(const leaderboard_t *board, const leaderboard_entry_t **out, size_t count) {
+    const skiplist_node_t *node;
+    size_t found = 0;
+
+    if (board->wal < 0)
+        return 0;
+    for (node = board->index.head->links[0].next; node != NULL && found < count; node = node->links[0].next)
+        out[found++] = board->table.entries + node->entry;
+    return found;
+}
+
+uint32_t leaderboard_rank(const leaderboard_t *board, const char name[MAX_PLAYER_NAME_SIZE], const leaderboard_entry_t **entry) {
+    int idx;
+
+    if (board->wal < 0 || (idx = table_find(&board->table, name)) == -1 || board->nodes[idx] == NULL)
+        return 0;
+    *entry = board->table.entries + idx;
+    return skiplist_rank(&board->index, &board->table, board->nodes[idx]);
+}
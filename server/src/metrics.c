@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "budget.h"
+#include "metrics.h"
+
+metrics_t METRICS;
+
+
+
+/////////// HISTOGRAM ////////////
+
+static uint32_t histogram_upper(int idx) {
+    int shift;
+
+    if (idx < HIST_SUB_COUNT)
+        return idx;
+    shift = idx / HIST_SUB_COUNT - 1;
+    return (((uint32_t)(HIST_SUB_COUNT + idx % HIST_SUB_COUNT) << shift) - 1) + ((uint32_t)1 << shift);
+}
+
+uint32_t histogram_percentile(const histogram_t *hist, double percentile) {
+    uint64_t target = (uint64_t)(hist->count * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if (hist->count == 0)
+        return 0;
+    if (target == 0)
+        target = 1;
+    for (int i = 0; i < HIST_BUCKETS; ++i)
+        if ((seen += hist->buckets[i]) >= target)
+            return histogram_upper(i) < hist->max ? histogram_upper(i) : hist->max;
+    return hist->max;
+}
+
+
+
+/////////// TEXT EXPOSITION ////////////
+
+#define     ADMIN_BUFFER_SIZE   65536
+
+static char ADMIN_BUFFER[ADMIN_BUFFER_SIZE];
+static size_t ADMIN_LEN;
+
+__attribute__((format(printf, 1, 2)))
+static void admin_print(const char *fmt, ...) {
+    va_list ap;
+    int len;
+
+    if (ADMIN_LEN >= ADMIN_BUFFER_SIZE)
+        return;
+    va_start(ap, fmt);
+    len = vsnprintf(ADMIN_BUFFER + ADMIN_LEN, ADMIN_BUFFER_SIZE - ADMIN_LEN, fmt, ap);
+    va_end(ap);
+    if (len > 0)
+        ADMIN_LEN += len;
+}
+
+static void admin_counter(const char *name, uint64_t value) {
+    admin_print("# TYPE %s counter\n%s %lu\n", name, name, value);
+}
+
+static void admin_packets(const char *name, const uint64_t *values) {
+    admin_print("# TYPE %s counter\n", name);
+    for (int i = 1; i < METRICS_PACKET_TYPES; ++i)
+        if (values[i] != 0)
+            admin_print("%s{type=\"%d\"} %lu\n", name, i, values[i]);
+}
+
+static void admin_histogram(const char *name, const histogram_t *hist) {
+    uint64_t cumulative = 0;
+
+    admin_print("# TYPE %s histogram\n", name);
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        if (hist->buckets[i] == 0)
+            continue;
+        cumulative += hist->buckets[i];
+        admin_print("%s_bucket{le=\"%u\"} %lu\n", name, histogram_upper(i), cumulative);
+    }
+    admin_print("%s_bucket{le=\"+Inf\"} %lu\n", name, hist->count);
+    admin_print("%s_sum %lu\n%s_count %lu\n", name, hist->sum, name, hist->count);
+    // A histogram family only holds buckets, sum and count: the rest are gauges
+    admin_print("# TYPE %s_max gauge\n%s_max %u\n", name, name, hist->max);
+    admin_print("# TYPE %s_p50 gauge\n%s_p50 %u\n", name, name, histogram_percentile(hist, 50.0));
+    admin_print("# TYPE %s_p99 gauge\n%s_p99 %u\n", name, name, histogram_percentile(hist, 99.0));
+}
+
+static void admin_memory(void) {
+    admin_print("# TYPE tr_memory_bytes gauge\n");
+    for (int i = 0; i < MEM_SUBSYSTEMS; ++i)
+        admin_print("tr_memory_bytes{subsystem=\"%s\"} %zu\n", MEMORY_SUBSYSTEMS[i], __atomic_load_n(MEMORY.used + i, __ATOMIC_RELAXED));
+    admin_print("# TYPE tr_memory_peak_bytes gauge\ntr_memory_peak_bytes %zu\n", __atomic_load_n(&MEMORY.peak, __ATOMIC_RELAXED));
+    admin_print("# TYPE tr_memory_budget_bytes gauge\ntr_memory_budget_bytes %zu\n", MEMORY.limit);
+    admin_counter("tr_memory_refused_total", __atomic_load_n(&MEMORY.refused, __ATOMIC_RELAXED));
+}
+
+static void admin_render(void) {
+    ADMIN_LEN = 0;
+    admin_counter("tr_connections_total", METRICS.connections);
+    admin_counter("tr_rooms_started_total", METRICS.rooms_started);
+    admin_counter("tr_rooms_ended_total", METRICS.rooms_ended);
+    admin_counter("tr_broken_sockets_total", METRICS.broken_sockets);
+    admin_counter("tr_evictions_total", METRICS.evictions);
+    admin_counter("tr_protocol_errors_total", METRICS.protocol_errors);
+    admin_counter("tr_sessions_resumed_total", METRICS.sessions_resumed);
+    admin_counter("tr_reactor_syscalls_total", METRICS.syscalls);
+    admin_counter("tr_words_completed_total", METRICS.words_completed);
+    admin_counter("tr_completions_flagged_total", METRICS.completions_flagged);
+    admin_counter("tr_datagrams_stale_total", METRICS.datagrams_stale);
+    admin_counter("tr_datagrams_rejected_total", METRICS.datagrams_rejected);
+    admin_packets("tr_packets_in_total", METRICS.packets_in);
+    admin_packets("tr_bytes_in_total", METRICS.bytes_in);
+    admin_packets("tr_packets_out_total", METRICS.packets_out);
+    admin_packets("tr_bytes_out_total", METRICS.bytes_out);
+    admin_histogram("tr_loop_busy_ns", &METRICS.loop_busy_ns);
+    admin_histogram("tr_word_latency_us", &METRICS.word_latency_us);
+    admin_histogram("tr_outq_bytes", &METRICS.outq_bytes);
+    admin_histogram("tr_rtt_us", &METRICS.rtt_us);
+    admin_histogram("tr_typing_wpm_hundredths", &METRICS.typing_wpm);
+    admin_histogram("tr_typing_bigram_ms", &METRICS.typing_bigram_ms);
+    admin_memory();
+}
+
+
+
+/////////// ADMIN SOCKET ////////////
+
+int admin_init(const char *path) {
+    struct sockaddr_un addr = {.sun_family=AF_UNIX};
+    int sockfd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "[ERROR] Admin socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if ((sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sockfd, 8) < 0) {
+        perror("admin bind");
+        close(sockfd);
+        return -1;
+    }
+    printf("[INFO] Admin socket listening on %s\n", path);
+    return sockfd;
+}
+
+void admin_serve(int client) {
+    // Never let a slow scraper stall the game loop
+    fcntl(client, F_SETFL, O_NONBLOCK);
+    admin_render();
+    if (send(client, ADMIN_BUFFER, ADMIN_LEN, MSG_NOSIGNAL) < 0)
+        perror("admin write");
+    close(client);
+}
+
+void admin_destroy(const char *path) {
+    if (path != NULL)
+        unlink(path);
+}
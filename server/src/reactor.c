@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "budget.h"
+#include "metrics.h"
+#include "reactor.h"
+
+int reactor_init(reactor_t *reactor, const char *backend, reactor_handler_t handler) {
+    static const reactor_backend_t *BACKENDS[] = {&REACTOR_SELECT, &REACTOR_URING};
+
+    reactor->handler = handler;
+    reactor->impl = NULL;
+    for (size_t i = 0; i < sizeof(BACKENDS) / sizeof(*BACKENDS); ++i) {
+        if (strcmp(BACKENDS[i]->name, backend) != 0)
+            continue;
+        reactor->backend = BACKENDS[i];
+        if (reactor->backend->init(reactor) < 0)
+            return -1;
+        printf("[INFO] Using %s reactor\n", backend);
+        return 0;
+    }
+    fprintf(stderr, "[ERROR] Unknown reactor backend: %s\n", backend);
+    return -1;
+}
+
+void reactor_close(reactor_t *reactor, int socket) {
+    if (socket < 0)
+        return;
+    reactor->backend->unwatch(reactor, socket);
+    close(socket);
+}
+
+
+
+/////////// SELECT BACKEND ////////////
+
+#define     SELECT_READ_SIZE    4096
+
+typedef struct select_impl_s
+{
+    fd_set  watched;
+    fd_set  listeners;
+    fd_set  pollers;
+    int     max_fd;
+} select_impl_t;
+
+static int select_init(reactor_t *reactor) {
+    select_impl_t *impl = mem_alloc(MEM_NETWORK, sizeof(select_impl_t));
+
+    if (impl == NULL) {
+        fprintf(stderr, "[ERROR] No memory left for the reactor\n");
+        return -1;
+    }
+    FD_ZERO(&impl->watched);
+    FD_ZERO(&impl->listeners);
+    FD_ZERO(&impl->pollers);
+    impl->max_fd = -1;
+    reactor->impl = impl;
+    return 0;
+}
+
+static void select_destroy(reactor_t *reactor) {
+    mem_free(MEM_NETWORK, reactor->impl, sizeof(select_impl_t));
+    reactor->impl = NULL;
+}
+
+static int select_add(select_impl_t *impl, int socket, fd_set *kind) {
+    if (socket >= FD_SETSIZE) {
+        fprintf(stderr, "[ERROR] Socket %d above FD_SETSIZE\n", socket);
+        return -1;
+    }
+    FD_SET(socket, &impl->watched);
+    if (kind != NULL)
+        FD_SET(socket, kind);
+    if (socket > impl->max_fd)
+        impl->max_fd = socket;
+    return 0;
+}
+
+static int select_listen(reactor_t *reactor, int socket) {
+    select_impl_t *impl = reactor->impl;
+
+    return select_add(impl, socket, &impl->listeners);
+}
+
+static int select_watch(reactor_t *reactor, int socket) {
+    select_impl_t *impl = reactor->impl;
+
+    return select_add(impl, socket, NULL);
+}
+
+static int select_poll(reactor_t *reactor, int socket) {
+    select_impl_t *impl = reactor->impl;
+
+    return select_add(impl, socket, &impl->pollers);
+}
+
+static void select_unwatch(reactor_t *reactor, int socket) {
+    select_impl_t *impl = reactor->impl;
+
+    if (socket < FD_SETSIZE) {
+        FD_CLR(socket, &impl->watched);
+        FD_CLR(socket, &impl->listeners);
+        FD_CLR(socket, &impl->pollers);
+    }
+}
+
+static ssize_t select_send(reactor_t *reactor, int socket, const void *data, size_t size) {
+    (void)reactor;
+    METRICS.syscalls++;
+    return send(socket, data, size, MSG_NOSIGNAL);
+}
+
+static int select_wait(reactor_t *reactor, const struct timespec *timeout, const sigset_t *sigset) {
+    static char BUFFER[SELECT_READ_SIZE];
+    select_impl_t *impl = reactor->impl;
+    reactor_handler_t *handler = &reactor->handler;
+    fd_set rd_set = impl->watched;
+    ssize_t size;
+    int socket;
+    int ready;
+
+    METRICS.syscalls++;
+    ready = pselect(impl->max_fd + 1, &rd_set, NULL, NULL, timeout, sigset);
+    reactor->woke = clock_now_ns();
+    if (ready <= 0)
+        return ready;
+    for (int fd = 0; fd <= impl->max_fd && ready > 0; ++fd) {
+        if (!FD_ISSET(fd, &rd_set))
+            continue;
+        ready--;
+        // Handlers may close sockets further down the set
+        if (!FD_ISSET(fd, &impl->watched))
+            continue;
+        if (FD_ISSET(fd, &impl->pollers))
+            handler->readable(handler->ctx, fd);
+        else if (FD_ISSET(fd, &impl->listeners)) {
+            METRICS.syscalls++;
+            if ((socket = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+                perror("accept");
+            else
+                handler->accept(handler->ctx, fd, socket);
+        } else {
+            METRICS.syscalls++;
+            size = read(fd, BUFFER, SELECT_READ_SIZE);
+            handler->data(handler->ctx, fd, BUFFER, size);
+        }
+    }
+    return 0;
+}
+
+static void select_flush(reactor_t *reactor) {
+    (void)reactor;
+}
+
+// Reads and sends only happen inside calls: nothing is ever in flight
+static void select_quiesce(reactor_t *reactor) {
+    (void)reactor;
+}
+
+static void select_resume(reactor_t *reactor) {
+    (void)reactor;
+}
+
+const reactor_backend_t REACTOR_SELECT = {
+    .name="select",
+    .init=select_init,
+    .destroy=select_destroy,
+    .listen=select_listen,
+    .watch=select_watch,
+    .poll=select_poll,
+    .unwatch=select_unwatch,
+    .send=select_send,
+    .wait=select_wait,
+    .flush=select_flush,
+    .quiesce=select_quiesce,
+    .resume=select_resume,
+};
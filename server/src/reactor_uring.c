@@ -0,0 +1,642 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "budget.h"
+#include "metrics.h"
+#include "reactor.h"
+
+// io_uring backend: multishot accept and receive, receive buffers from a
+// registered buffer ring, and per-socket send buffers carved out of one
+// registered region. Sends produced during a loop iteration are coalesced
+// per socket and submitted together with the next wait, so a steady-state
+// iteration costs a single io_uring_enter. A burst that outgrows its fixed
+// buffer spills into a heap queue, drained into the buffer as it empties.
+// Fixed writes cannot take MSG_NOSIGNAL: the server ignores SIGPIPE.
+
+#define     URING_ENTRIES       256
+#define     URING_RECV_BUFFERS  64
+#define     URING_RECV_SIZE     4096
+#define     URING_SEND_SLOTS    64
+#define     URING_SEND_SIZE     4096
+// A peer this far behind stopped reading: the socket is given up on
+#define     URING_SPILL_MAX     (256 * 1024)
+#define     URING_BGID          0
+// Receive and send pools are sized once, and charged as such
+#define     URING_POOL_SIZE     (URING_RECV_BUFFERS * (URING_RECV_SIZE + sizeof(struct io_uring_buf)) \
+                                + URING_SEND_SLOTS * URING_SEND_SIZE)
+
+typedef enum uring_op_e {
+    OP_ACCEPT,
+    OP_RECV,
+    OP_SEND,
+    OP_CANCEL,
+    OP_POLL,
+} uring_op_t;
+
+typedef enum uring_state_e {
+    UNUSED,
+    LISTENER,
+    CONNECTION,
+    POLLER,
+} uring_state_t;
+
+// user_data layout: generation (32) | fd or send slot (24) | op (8)
+#define     URING_DATA(gen, idx, op)    (((uint64_t)(gen) << 32) | ((uint64_t)(idx) << 8) | (op))
+#define     URING_GEN(data)             ((uint32_t)((data) >> 32))
+#define     URING_IDX(data)             ((int)(((data) >> 8) & 0xffffff))
+#define     URING_OP(data)              ((uring_op_t)((data) & 0xff))
+
+typedef struct uring_conn_s
+{
+    uring_state_t   state;
+    uint32_t        gen;
+    int             slot;
+    int             armed;
+} uring_conn_t;
+
+typedef struct uring_slot_s
+{
+    int     socket;
+    int     orphan;
+    size_t  queued;
+    size_t  inflight;
+    char   *data;
+    // Overflow of data, sent after it in order
+    char   *spill;
+    size_t  spilled;
+    size_t  spill_size;
+} uring_slot_t;
+
+typedef struct uring_impl_s
+{
+    int                         fd;
+    // Submission ring
+    unsigned                   *sq_head;
+    unsigned                   *sq_tail;
+    unsigned                    sq_mask;
+    unsigned                   *sq_array;
+    struct io_uring_sqe        *sqes;
+    unsigned                    sq_pending;
+    // Completion ring
+    unsigned                   *cq_head;
+    unsigned                   *cq_tail;
+    unsigned                    cq_mask;
+    struct io_uring_cqe        *cqes;
+    void                       *ring;
+    size_t                      ring_size;
+    size_t                      sqes_size;
+    // Registered memory
+    struct io_uring_buf_ring   *buf_ring;
+    char                       *recv_buffers;
+    char                       *send_buffers;
+    uring_slot_t                slots[URING_SEND_SLOTS];
+    uring_conn_t                conns[FD_SETSIZE];
+    int                         quiescing;
+} uring_impl_t;
+
+
+
+/////////// RING ////////////
+
+static int uring_enter(uring_impl_t *impl, unsigned submit, unsigned wait, const struct timespec *timeout, const sigset_t *sigset) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {.sigmask=(uint64_t)(uintptr_t)sigset, .sigmask_sz=_NSIG / 8};
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+
+    if (wait > 0 && timeout != NULL) {
+        ts = (struct __kernel_timespec){.tv_sec=timeout->tv_sec, .tv_nsec=timeout->tv_nsec};
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    METRICS.syscalls++;
+    ret = syscall(__NR_io_uring_enter, impl->fd, submit, wait, flags,
+        flags & IORING_ENTER_EXT_ARG ? (void *)&arg : (void *)sigset,
+        flags & IORING_ENTER_EXT_ARG ? sizeof(arg) : _NSIG / 8);
+    if (ret >= 0)
+        impl->sq_pending -= (unsigned)ret < impl->sq_pending ? (unsigned)ret : impl->sq_pending;
+    return ret;
+}
+
+static int uring_submit(uring_impl_t *impl) {
+    if (impl->sq_pending == 0)
+        return 0;
+    return uring_enter(impl, impl->sq_pending, 0, NULL, NULL);
+}
+
+static struct io_uring_sqe *uring_sqe(uring_impl_t *impl) {
+    unsigned tail = *impl->sq_tail;
+    struct io_uring_sqe *sqe;
+
+    // Ring full: push what we have so far to make room
+    if (tail - atomic_load_explicit((_Atomic unsigned *)impl->sq_head, memory_order_acquire) > impl->sq_mask) {
+        uring_submit(impl);
+        if (tail - atomic_load_explicit((_Atomic unsigned *)impl->sq_head, memory_order_acquire) > impl->sq_mask)
+            return NULL;
+    }
+    sqe = impl->sqes + (tail & impl->sq_mask);
+    memset(sqe, 0, sizeof(*sqe));
+    impl->sq_array[tail & impl->sq_mask] = tail & impl->sq_mask;
+    atomic_store_explicit((_Atomic unsigned *)impl->sq_tail, tail + 1, memory_order_release);
+    impl->sq_pending++;
+    return sqe;
+}
+
+static void uring_recycle(uring_impl_t *impl, unsigned short bid) {
+    struct io_uring_buf *buf = impl->buf_ring->bufs + (impl->buf_ring->tail & (URING_RECV_BUFFERS - 1));
+
+    buf->addr = (uint64_t)(uintptr_t)(impl->recv_buffers + (size_t)bid * URING_RECV_SIZE);
+    buf->len = URING_RECV_SIZE;
+    buf->bid = bid;
+    atomic_store_explicit((_Atomic unsigned short *)&impl->buf_ring->tail, impl->buf_ring->tail + 1, memory_order_release);
+}
+
+static int uring_arm_accept(uring_impl_t *impl, int socket) {
+    struct io_uring_sqe *sqe = uring_sqe(impl);
+
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_DATA(impl->conns[socket].gen, socket, OP_ACCEPT);
+    impl->conns[socket].armed = 1;
+    return 0;
+}
+
+static int uring_arm_recv(uring_impl_t *impl, int socket) {
+    struct io_uring_sqe *sqe = uring_sqe(impl);
+
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = URING_DATA(impl->conns[socket].gen, socket, OP_RECV);
+    impl->conns[socket].armed = 1;
+    return 0;
+}
+
+static int uring_arm_poll(uring_impl_t *impl, int socket) {
+    struct io_uring_sqe *sqe = uring_sqe(impl);
+
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = socket;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_DATA(impl->conns[socket].gen, socket, OP_POLL);
+    impl->conns[socket].armed = 1;
+    return 0;
+}
+
+static void uring_arm_send(uring_impl_t *impl, int idx) {
+    uring_slot_t *slot = impl->slots + idx;
+    struct io_uring_sqe *sqe;
+
+    if (slot->inflight != 0 || slot->queued == 0 || (sqe = uring_sqe(impl)) == NULL)
+        return;
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = slot->socket;
+    sqe->addr = (uint64_t)(uintptr_t)slot->data;
+    sqe->len = slot->queued;
+    sqe->buf_index = 0;
+    sqe->user_data = URING_DATA(0, idx, OP_SEND);
+    slot->inflight = slot->queued;
+}
+
+static void uring_release_slot(uring_impl_t *impl, int idx) {
+    mem_free(MEM_NETWORK, impl->slots[idx].spill, impl->slots[idx].spill_size);
+    impl->slots[idx] = (uring_slot_t){.socket=-1, .data=impl->send_buffers + (size_t)idx * URING_SEND_SIZE};
+}
+
+
+
+/////////// SETUP ////////////
+
+static int uring_map(uring_impl_t *impl, unsigned entries) {
+    struct io_uring_params params = {0};
+    char *sq;
+    char *cq;
+
+    METRICS.syscalls++;
+    if ((impl->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        fprintf(stderr, "[ERROR] io_uring is too old for this backend\n");
+        return -1;
+    }
+    impl->ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > impl->ring_size)
+        impl->ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    impl->ring = mmap(NULL, impl->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, impl->fd, IORING_OFF_SQ_RING);
+    impl->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    impl->sqes = mmap(NULL, impl->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, impl->fd, IORING_OFF_SQES);
+    if (impl->ring == MAP_FAILED || impl->sqes == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    sq = cq = impl->ring;
+    impl->sq_head = (unsigned *)(sq + params.sq_off.head);
+    impl->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    impl->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    impl->sq_array = (unsigned *)(sq + params.sq_off.array);
+    impl->cq_head = (unsigned *)(cq + params.cq_off.head);
+    impl->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    impl->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    impl->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static int uring_register(uring_impl_t *impl) {
+    size_t ring_size = URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    struct io_uring_buf_reg reg = {.ring_entries=URING_RECV_BUFFERS, .bgid=URING_BGID};
+    struct iovec iov;
+
+    impl->buf_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    impl->recv_buffers = mmap(NULL, URING_RECV_BUFFERS * URING_RECV_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    impl->send_buffers = mmap(NULL, URING_SEND_SLOTS * URING_SEND_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (impl->buf_ring == MAP_FAILED || impl->recv_buffers == MAP_FAILED || impl->send_buffers == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    reg.ring_addr = (uint64_t)(uintptr_t)impl->buf_ring;
+    METRICS.syscalls++;
+    if (syscall(__NR_io_uring_register, impl->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register(PBUF_RING)");
+        return -1;
+    }
+    impl->buf_ring->tail = 0;
+    for (unsigned short bid = 0; bid < URING_RECV_BUFFERS; ++bid)
+        uring_recycle(impl, bid);
+    iov = (struct iovec){.iov_base=impl->send_buffers, .iov_len=URING_SEND_SLOTS * URING_SEND_SIZE};
+    METRICS.syscalls++;
+    if (syscall(__NR_io_uring_register, impl->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+        perror("io_uring_register(BUFFERS)");
+        return -1;
+    }
+    for (int i = 0; i < URING_SEND_SLOTS; ++i)
+        uring_release_slot(impl, i);
+    return 0;
+}
+
+static void uring_destroy(reactor_t *reactor) {
+    uring_impl_t *impl = reactor->impl;
+
+    if (impl == NULL)
+        return;
+    if (impl->fd >= 0)
+        close(impl->fd);
+    if (impl->ring != NULL && impl->ring != MAP_FAILED)
+        munmap(impl->ring, impl->ring_size);
+    if (impl->sqes != NULL && impl->sqes != MAP_FAILED)
+        munmap(impl->sqes, impl->sqes_size);
+    if (impl->buf_ring != NULL && impl->buf_ring != MAP_FAILED)
+        munmap(impl->buf_ring, URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+    if (impl->recv_buffers != NULL && impl->recv_buffers != MAP_FAILED)
+        munmap(impl->recv_buffers, URING_RECV_BUFFERS * URING_RECV_SIZE);
+    if (impl->send_buffers != NULL && impl->send_buffers != MAP_FAILED)
+        munmap(impl->send_buffers, URING_SEND_SLOTS * URING_SEND_SIZE);
+    for (int i = 0; i < URING_SEND_SLOTS; ++i)
+        mem_free(MEM_NETWORK, impl->slots[i].spill, impl->slots[i].spill_size);
+    mem_discharge(MEM_NETWORK, URING_POOL_SIZE);
+    mem_free(MEM_NETWORK, impl, sizeof(uring_impl_t));
+    reactor->impl = NULL;
+}
+
+static int uring_init(reactor_t *reactor) {
+    uring_impl_t *impl = mem_alloc(MEM_NETWORK, sizeof(uring_impl_t));
+
+    if (impl == NULL || mem_charge(MEM_NETWORK, URING_POOL_SIZE) < 0) {
+        fprintf(stderr, "[ERROR] No memory left for the reactor\n");
+        mem_free(MEM_NETWORK, impl, sizeof(uring_impl_t));
+        return -1;
+    }
+    impl->fd = -1;
+    reactor->impl = impl;
+    if (uring_map(impl, URING_ENTRIES) < 0 || uring_register(impl) < 0) {
+        uring_destroy(reactor);
+        return -1;
+    }
+    return 0;
+}
+
+
+
+/////////// BACKEND ////////////
+
+static int uring_listen(reactor_t *reactor, int socket) {
+    uring_impl_t *impl = reactor->impl;
+
+    if (socket >= FD_SETSIZE)
+        return -1;
+    impl->conns[socket].state = LISTENER;
+    impl->conns[socket].gen++;
+    impl->conns[socket].slot = -1;
+    return uring_arm_accept(impl, socket);
+}
+
+static int uring_watch(reactor_t *reactor, int socket) {
+    uring_impl_t *impl = reactor->impl;
+    uring_conn_t *conn;
+    int idx = 0;
+
+    if (socket >= FD_SETSIZE)
+        return -1;
+    while (idx < URING_SEND_SLOTS && impl->slots[idx].socket != -1)
+        idx++;
+    if (idx == URING_SEND_SLOTS) {
+        fprintf(stderr, "[ERROR] No io_uring send slot left for socket %d\n", socket);
+        return -1;
+    }
+    impl->slots[idx].socket = socket;
+    conn = impl->conns + socket;
+    conn->state = CONNECTION;
+    conn->gen++;
+    conn->slot = idx;
+    return uring_arm_recv(impl, socket);
+}
+
+static int uring_poll(reactor_t *reactor, int socket) {
+    uring_impl_t *impl = reactor->impl;
+
+    if (socket >= FD_SETSIZE)
+        return -1;
+    impl->conns[socket].state = POLLER;
+    impl->conns[socket].gen++;
+    impl->conns[socket].slot = -1;
+    return uring_arm_poll(impl, socket);
+}
+
+static void uring_unwatch(reactor_t *reactor, int socket) {
+    uring_impl_t *impl = reactor->impl;
+    static const uring_op_t ARMED[] = {[LISTENER]=OP_ACCEPT, [CONNECTION]=OP_RECV, [POLLER]=OP_POLL};
+    uring_conn_t *conn;
+    struct io_uring_sqe *sqe;
+
+    if (socket < 0 || socket >= FD_SETSIZE || impl->conns[socket].state == UNUSED)
+        return;
+    conn = impl->conns + socket;
+    if ((sqe = uring_sqe(impl)) != NULL) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = URING_DATA(conn->gen, socket, ARMED[conn->state]);
+        sqe->user_data = URING_DATA(0, socket, OP_CANCEL);
+    }
+    if (conn->slot != -1) {
+        // Whatever was queued leaves before the descriptor goes away
+        uring_arm_send(impl, conn->slot);
+        if (impl->slots[conn->slot].inflight == 0)
+            uring_release_slot(impl, conn->slot);
+        else
+            impl->slots[conn->slot].orphan = 1;
+    }
+    uring_submit(impl);
+    conn->state = UNUSED;
+    conn->gen++;
+    conn->slot = -1;
+    conn->armed = 0;
+}
+
+static int uring_spill(uring_slot_t *slot, const void *data, size_t size) {
+    size_t needed = slot->spilled + size;
+    size_t grown = slot->spill_size == 0 ? URING_SEND_SIZE : slot->spill_size;
+    char *spill;
+
+    if (needed > URING_SPILL_MAX)
+        return -1;
+    while (grown < needed)
+        grown *= 2;
+    if (grown != slot->spill_size) {
+        if ((spill = mem_realloc(MEM_NETWORK, slot->spill, slot->spill_size, grown)) == NULL)
+            return -1;
+        slot->spill = spill;
+        slot->spill_size = grown;
+    }
+    memcpy(slot->spill + slot->spilled, data, size);
+    slot->spilled += size;
+    return 0;
+}
+
+// Moves spilled bytes behind whatever the fixed buffer still holds
+static void uring_refill(uring_slot_t *slot) {
+    size_t size = URING_SEND_SIZE - slot->queued;
+
+    if (slot->spilled == 0 || size == 0)
+        return;
+    if (size > slot->spilled)
+        size = slot->spilled;
+    memcpy(slot->data + slot->queued, slot->spill, size);
+    memmove(slot->spill, slot->spill + size, slot->spilled - size);
+    slot->queued += size;
+    slot->spilled -= size;
+}
+
+static ssize_t uring_send(reactor_t *reactor, int socket, const void *data, size_t size) {
+    uring_impl_t *impl = reactor->impl;
+    uring_slot_t *slot;
+
+    if (socket < 0 || socket >= FD_SETSIZE || impl->conns[socket].slot == -1)
+        return -1;
+    slot = impl->slots + impl->conns[socket].slot;
+    if (slot->spilled == 0 && slot->queued + size <= URING_SEND_SIZE) {
+        memcpy(slot->data + slot->queued, data, size);
+        slot->queued += size;
+        return size;
+    }
+    if (uring_spill(slot, data, size) < 0)
+        return -1;
+    return size;
+}
+
+static void uring_flush(reactor_t *reactor) {
+    uring_impl_t *impl = reactor->impl;
+
+    for (int i = 0; i < URING_SEND_SLOTS; ++i)
+        if (impl->slots[i].socket != -1 && !impl->slots[i].orphan)
+            uring_arm_send(impl, i);
+}
+
+static void uring_complete_send(reactor_t *reactor, int idx, int res) {
+    uring_impl_t *impl = reactor->impl;
+    uring_slot_t *slot = impl->slots + idx;
+    size_t sent = res > 0 ? (size_t)res : 0;
+
+    if (res < 0 && !slot->orphan)
+        reactor->handler.send_error(reactor->handler.ctx, slot->socket);
+    if (slot->orphan) {
+        uring_release_slot(impl, idx);
+        return;
+    }
+    // Partial writes keep their tail queued for the next flush
+    memmove(slot->data, slot->data + sent, slot->queued - sent);
+    slot->queued -= sent;
+    slot->inflight = 0;
+    uring_refill(slot);
+}
+
+static void uring_complete(reactor_t *reactor, const struct io_uring_cqe *cqe) {
+    uring_impl_t *impl = reactor->impl;
+    reactor_handler_t *handler = &reactor->handler;
+    int idx = URING_IDX(cqe->user_data);
+    int live = URING_OP(cqe->user_data) != OP_SEND && idx < FD_SETSIZE
+        && impl->conns[idx].state != UNUSED && impl->conns[idx].gen == URING_GEN(cqe->user_data);
+
+    // The multishot operation is over, it is re-armed below unless quiescing
+    if (live && URING_OP(cqe->user_data) != OP_CANCEL && !(cqe->flags & IORING_CQE_F_MORE))
+        impl->conns[idx].armed = 0;
+
+    switch (URING_OP(cqe->user_data))
+    {
+    case OP_ACCEPT:
+        if (!live) {
+            if (cqe->res >= 0)
+                close(cqe->res);
+            break;
+        }
+        if (cqe->res >= 0)
+            handler->accept(handler->ctx, idx, cqe->res);
+        else if (cqe->res != -ECANCELED)
+            fprintf(stderr, "[ERROR] accept: %s\n", strerror(-cqe->res));
+        if (!(cqe->flags & IORING_CQE_F_MORE) && impl->conns[idx].state == LISTENER && !impl->quiescing)
+            uring_arm_accept(impl, idx);
+        break;
+
+    case OP_RECV:
+        if (live && cqe->res > 0)
+            handler->data(handler->ctx, idx, impl->recv_buffers + (size_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) * URING_RECV_SIZE, cqe->res);
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            uring_recycle(impl, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!live || cqe->res == -ECANCELED)
+            break;
+        if (cqe->res <= 0 && cqe->res != -ENOBUFS)
+            handler->data(handler->ctx, idx, NULL, cqe->res);
+        else if (!(cqe->flags & IORING_CQE_F_MORE) && impl->conns[idx].state == CONNECTION
+            && impl->conns[idx].gen == URING_GEN(cqe->user_data) && !impl->quiescing)
+            uring_arm_recv(impl, idx);
+        break;
+
+    case OP_SEND:
+        uring_complete_send(reactor, idx, cqe->res);
+        break;
+
+    case OP_POLL:
+        if (live && cqe->res > 0)
+            handler->readable(handler->ctx, idx);
+        if (live && cqe->res >= 0 && !(cqe->flags & IORING_CQE_F_MORE) && impl->conns[idx].state == POLLER
+            && impl->conns[idx].gen == URING_GEN(cqe->user_data) && !impl->quiescing)
+            uring_arm_poll(impl, idx);
+        break;
+
+    case OP_CANCEL:
+        break;
+    }
+}
+
+static void uring_reap(reactor_t *reactor) {
+    uring_impl_t *impl = reactor->impl;
+    unsigned head = *impl->cq_head;
+
+    while (head != atomic_load_explicit((_Atomic unsigned *)impl->cq_tail, memory_order_acquire)) {
+        struct io_uring_cqe cqe = impl->cqes[head & impl->cq_mask];
+
+        // Release the entry first: handlers may queue more work
+        atomic_store_explicit((_Atomic unsigned *)impl->cq_head, ++head, memory_order_release);
+        uring_complete(reactor, &cqe);
+        head = *impl->cq_head;
+    }
+}
+
+static int uring_wait(reactor_t *reactor, const struct timespec *timeout, const sigset_t *sigset) {
+    uring_impl_t *impl = reactor->impl;
+    int ret;
+
+    ret = uring_enter(impl, impl->sq_pending, 1, timeout, sigset);
+    reactor->woke = clock_now_ns();
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+        return -1;
+    if (ret < 0 && errno == EINTR)
+        return -1;
+    uring_reap(reactor);
+    return 0;
+}
+
+static int uring_busy(const uring_impl_t *impl) {
+    for (int i = 0; i < FD_SETSIZE; ++i)
+        if (impl->conns[i].state != UNUSED && impl->conns[i].armed)
+            return 1;
+    for (int i = 0; i < URING_SEND_SLOTS; ++i)
+        if (impl->slots[i].socket != -1 && (impl->slots[i].inflight != 0 || impl->slots[i].queued != 0 || impl->slots[i].spilled != 0))
+            return 1;
+    return 0;
+}
+
+// Cancels every armed operation but keeps the sockets live, so receives
+// that completed before the cancel are still dispatched
+static void uring_quiesce(reactor_t *reactor) {
+    static const uring_op_t ARMED[] = {[LISTENER]=OP_ACCEPT, [CONNECTION]=OP_RECV, [POLLER]=OP_POLL};
+    static const struct timespec STEP = {.tv_sec=0, .tv_nsec=10000000};
+    uring_impl_t *impl = reactor->impl;
+    struct io_uring_sqe *sqe;
+
+    impl->quiescing = 1;
+    for (int i = 0; i < FD_SETSIZE; ++i) {
+        if (impl->conns[i].state == UNUSED || !impl->conns[i].armed || (sqe = uring_sqe(impl)) == NULL)
+            continue;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = URING_DATA(impl->conns[i].gen, i, ARMED[impl->conns[i].state]);
+        sqe->user_data = URING_DATA(0, i, OP_CANCEL);
+    }
+    // Bounded: a peer that stopped reading must not hold the upgrade
+    for (int tries = 0; uring_busy(impl) && tries < 100; ++tries) {
+        uring_flush(reactor);
+        if (uring_enter(impl, impl->sq_pending, 1, &STEP, NULL) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+            break;
+        uring_reap(reactor);
+    }
+}
+
+static void uring_resume(reactor_t *reactor) {
+    static int (*const ARM[])(uring_impl_t *, int) = {[LISTENER]=uring_arm_accept, [CONNECTION]=uring_arm_recv, [POLLER]=uring_arm_poll};
+    uring_impl_t *impl = reactor->impl;
+
+    impl->quiescing = 0;
+    for (int i = 0; i < FD_SETSIZE; ++i)
+        if (impl->conns[i].state != UNUSED && !impl->conns[i].armed)
+            ARM[impl->conns[i].state](impl, i);
+    uring_submit(impl);
+}
+
+const reactor_backend_t REACTOR_URING = {
+    .name="uring",
+    .init=uring_init,
+    .destroy=uring_destroy,
+    .listen=uring_listen,
+    .watch=uring_watch,
+    .poll=uring_poll,
+    .unwatch=uring_unwatch,
+    .send=uring_send,
+    .wait=uring_wait,
+    .flush=uring_flush,
+    .quiesce=uring_quiesce,
+    .resume=uring_resume,
+};
@@ -0,0 +1,402 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "budget.h"
+#include "replay.h"
+
+#define     REPLAY_INITIAL_SIZE     (256 * 1024)
+
+typedef struct replay_header_s
+{
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    reserved;
+    int64_t     created;
+} replay_header_t;
+
+// Every record: when, what and how many payload bytes follow
+typedef struct __attribute__((packed)) replay_record_s
+{
+    uint32_t    time_us;
+    uint8_t     type;
+    uint8_t     size;
+} replay_record_t;
+
+typedef struct replay_trailer_s
+{
+    uint32_t    magic;
+    uint32_t    count;
+    uint64_t    index_offset;
+} replay_trailer_t;
+
+
+
+/////////// WRITER ////////////
+
+static int replay_reserve(replay_writer_t *writer, size_t size) {
+    size_t grown = writer->size;
+    char *map;
+
+    while (writer->length + size > grown)
+        grown *= 2;
+    if (grown == writer->size)
+        return 0;
+    // Dirty pages of the log count until the page cache writes them back
+    if (mem_charge(MEM_REPLAY, grown - writer->size) < 0) {
+        fprintf(stderr, "[ERROR] Replay log over the memory budget, recording stopped\n");
+        return -1;
+    }
+    if (ftruncate(writer->fd, grown) < 0
+        || (map = mremap(writer->map, writer->size, grown, MREMAP_MAYMOVE)) == MAP_FAILED) {
+        perror("replay");
+        mem_discharge(MEM_REPLAY, grown - writer->size);
+        return -1;
+    }
+    writer->map = map;
+    writer->size = grown;
+    return 0;
+}
+
+static void replay_append(replay_writer_t *writer, int64_t now, replay_type_t type, const void *payload, size_t size) {
+    replay_record_t record = {.type=type, .size=size};
+
+    if (writer->map == NULL || size > UINT8_MAX || replay_reserve(writer, sizeof(record) + size) < 0)
+        return;
+    record.time_us = now > writer->start ? (now - writer->start) / 1000 : 0;
+    memcpy(writer->map + writer->length, &record, sizeof(record));
+    memcpy(writer->map + writer->length + sizeof(record), payload, size);
+    writer->length += sizeof(record) + size;
+}
+
+int replay_writer_open(replay_writer_t *writer, const char *path, int64_t start) {
+    replay_header_t header = {.magic=REPLAY_MAGIC, .version=REPLAY_VERSION, .created=time(NULL)};
+
+    *writer = (replay_writer_t){.fd=-1, .start=start, .next_keyframe=start};
+    if (mem_charge(MEM_REPLAY, REPLAY_INITIAL_SIZE) < 0) {
+        fprintf(stderr, "[ERROR] No memory left to record %s\n", path);
+        return -1;
+    }
+    if ((writer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0
+        || ftruncate(writer->fd, REPLAY_INITIAL_SIZE) < 0
+        || (writer->map = mmap(NULL, REPLAY_INITIAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, 0)) == MAP_FAILED) {
+        perror(path);
+        mem_discharge(MEM_REPLAY, REPLAY_INITIAL_SIZE);
+        if (writer->fd >= 0)
+            close(writer->fd);
+        *writer = (replay_writer_t){.fd=-1};
+        return -1;
+    }
+    writer->size = REPLAY_INITIAL_SIZE;
+    memcpy(writer->map, &header, sizeof(header));
+    writer->length = sizeof(header);
+    return 0;
+}
+
+// Footer with the keyframe index, then the file is cut to what was written
+void replay_writer_close(replay_writer_t *writer) {
+    replay_trailer_t trailer = {.magic=REPLAY_INDEX_MAGIC, .count=writer->index_count, .index_offset=writer->length};
+    size_t index_size = writer->index_count * sizeof(replay_index_t);
+
+    if (writer->map == NULL)
+        return;
+    if (replay_reserve(writer, index_size + sizeof(trailer)) == 0) {
+        memcpy(writer->map + writer->length, writer->index, index_size);
+        memcpy(writer->map + writer->length + index_size, &trailer, sizeof(trailer));
+        writer->length += index_size + sizeof(trailer);
+    }
+    munmap(writer->map, writer->size);
+    mem_discharge(MEM_REPLAY, writer->size);
+    if (ftruncate(writer->fd, writer->length) < 0)
+        perror("replay");
+    close(writer->fd);
+    mem_free(MEM_REPLAY, writer->index, writer->index_capacity * sizeof(replay_index_t));
+    *writer = (replay_writer_t){.fd=-1};
+}
+
+static replay_status_t replay_status(int64_t now, game_state_t state, int64_t deadline) {
+    replay_status_t status = {.state=state, .remain_ms=REPLAY_PAUSED};
+
+    if (deadline != 0)
+        status.remain_ms = deadline > now ? (deadline - now) / 1000000 : 0;
+    return status;
+}
+
+static size_t replay_put_status(char *payload, replay_status_t status) {
+    payload[0] = status.state;
+    memcpy(payload + 1, &status.remain_ms, sizeof(status.remain_ms));
+    return 1 + sizeof(status.remain_ms);
+}
+
+static size_t replay_put_player(char *payload, const replay_player_t *player) {
+    uint8_t len = strnlen(player->name, MAX_PLAYER_NAME_SIZE);
+
+    memcpy(payload, &player->player_id, sizeof(int32_t));
+    memcpy(payload + 4, &player->score, sizeof(int32_t));
+    payload[8] = len;
+    memcpy(payload + 9, player->name, len);
+    return 9 + len;
+}
+
+void replay_write_status(replay_writer_t *writer, int64_t now, game_state_t state, int64_t deadline) {
+    char payload[8];
+
+    replay_append(writer, now, REPLAY_STATUS, payload, replay_put_status(payload, replay_status(now, state, deadline)));
+}
+
+void replay_write_player(replay_writer_t *writer, int64_t now, replay_type_t type, const replay_player_t *player) {
+    char payload[32];
+    size_t size = replay_put_player(payload, player);
+
+    // Removals only need the id, completions the id and score
+    if (type == REPLAY_REMOVE)
+        size = 4;
+    else if (type == REPLAY_COMPLETE)
+        size = 8;
+    replay_append(writer, now, type, payload, size);
+}
+
+void replay_write_word(replay_writer_t *writer, int64_t now, int player_id, const char *word) {
+    char payload[4 + MAX_STRING_SIZE];
+    size_t len = strnlen(word, MAX_STRING_SIZE);
+
+    memcpy(payload, &player_id, sizeof(int32_t));
+    memcpy(payload + 4, word, len);
+    replay_append(writer, now, REPLAY_WORD, payload, 4 + len);
+}
+
+void replay_write_keyframe(replay_writer_t *writer, int64_t now, game_state_t state, int64_t deadline,
+    const replay_player_t *players, int count) {
+    char payload[UINT8_MAX];
+    size_t size;
+    replay_index_t *index;
+    size_t grown;
+
+    if (writer->map == NULL)
+        return;
+    if (writer->index_count == writer->index_capacity) {
+        grown = writer->index_capacity ? writer->index_capacity * 2 : 64;
+        if ((index = mem_realloc(MEM_REPLAY, writer->index, writer->index_capacity * sizeof(replay_index_t),
+            grown * sizeof(replay_index_t))) == NULL)
+            return;
+        writer->index = index;
+        writer->index_capacity = grown;
+    }
+    if (count > REPLAY_MAX_PLAYERS)
+        count = REPLAY_MAX_PLAYERS;
+    size = replay_put_status(payload, replay_status(now, state, deadline));
+    payload[size++] = count;
+    for (int i = 0; i < count; ++i)
+        size += replay_put_player(payload + size, players + i);
+    writer->index[writer->index_count++] = (replay_index_t){
+        .time_us=now > writer->start ? (now - writer->start) / 1000 : 0,
+        .offset=writer->length
+    };
+    writer->next_keyframe = now + REPLAY_KEYFRAME_INTERVAL;
+    replay_append(writer, now, REPLAY_KEYFRAME, payload, size);
+}
+
+
+
+/////////// READER ////////////
+
+static size_t replay_get_player(const char *payload, size_t size, replay_player_t *player) {
+    uint8_t len;
+
+    memset(player, 0, sizeof(*player));
+    if (size < 4)
+        return 0;
+    memcpy(&player->player_id, payload, sizeof(int32_t));
+    if (size < 8)
+        return 4;
+    memcpy(&player->score, payload + 4, sizeof(int32_t));
+    if (size < 9)
+        return 8;
+    len = (uint8_t)payload[8];
+    if (len > MAX_PLAYER_NAME_SIZE || 9 + (size_t)len > size)
+        return 0;
+    memcpy(player->name, payload + 9, len);
+    return 9 + len;
+}
+
+static int replay_decode(const replay_reader_t *reader, size_t offset, replay_event_t *event, size_t *next) {
+    replay_record_t record;
+    const char *payload;
+    size_t used;
+
+    if (offset + sizeof(record) > reader->end)
+        return 0;
+    memcpy(&record, reader->map + offset, sizeof(record));
+    if (record.type < REPLAY_KEYFRAME || record.type > REPLAY_COMPLETE || offset + sizeof(record) + record.size > reader->end)
+        return 0;
+    payload = reader->map + offset + sizeof(record);
+    event->type = record.type;
+    event->time_us = record.time_us;
+    switch (event->type)
+    {
+    case REPLAY_KEYFRAME:
+    case REPLAY_STATUS:
+        if (record.size < 5)
+            return 0;
+        event->status.state = payload[0];
+        memcpy(&event->status.remain_ms, payload + 1, sizeof(uint32_t));
+        if (event->type == REPLAY_STATUS)
+            break;
+        event->count = record.size > 5 ? (uint8_t)payload[5] : 0;
+        used = 6;
+        for (int i = 0; i < event->count; ++i) {
+            size_t size = i < REPLAY_MAX_PLAYERS ? replay_get_player(payload + used, record.size - used, event->players + i) : 0;
+
+            if (size < 9)
+                return 0;
+            used += size;
+        }
+        break;
+
+    case REPLAY_WORD:
+        memset(event->word, 0, sizeof(event->word));
+        if (record.size < 4 || record.size > 4 + MAX_STRING_SIZE)
+            return 0;
+        memcpy(&event->player.player_id, payload, sizeof(int32_t));
+        memcpy(event->word, payload + 4, record.size - 4);
+        break;
+
+    default:
+        if (replay_get_player(payload, record.size, &event->player) == 0)
+            return 0;
+    }
+    *next = offset + sizeof(record) + record.size;
+    return 1;
+}
+
+// No usable footer: walk the records, stopping at the first broken one
+static int replay_scan(replay_reader_t *reader) {
+    size_t offset = sizeof(replay_header_t);
+    size_t grown;
+    replay_event_t event;
+    replay_index_t *index;
+    size_t next;
+
+    reader->end = reader->size;
+    while (replay_decode(reader, offset, &event, &next)) {
+        if (event.type == REPLAY_KEYFRAME) {
+            if (reader->index_count == reader->index_capacity) {
+                grown = reader->index_capacity ? reader->index_capacity * 2 : 64;
+                if ((index = mem_realloc(MEM_PLAYBACK, reader->index, reader->index_capacity * sizeof(replay_index_t),
+                    grown * sizeof(replay_index_t))) == NULL) {
+                    fprintf(stderr, "[ERROR] No memory left for the replay index\n");
+                    return -1;
+                }
+                reader->index = index;
+                reader->index_capacity = grown;
+            }
+            reader->index[reader->index_count++] = (replay_index_t){.time_us=event.time_us, .offset=offset};
+        }
+        offset = next;
+    }
+    reader->end = offset;
+    return 0;
+}
+
+static int replay_load_index(replay_reader_t *reader) {
+    replay_trailer_t trailer;
+    size_t index_size;
+
+    if (reader->size < sizeof(replay_header_t) + sizeof(trailer))
+        return -1;
+    memcpy(&trailer, reader->map + reader->size - sizeof(trailer), sizeof(trailer));
+    index_size = (size_t)trailer.count * sizeof(replay_index_t);
+    if (trailer.magic != REPLAY_INDEX_MAGIC || trailer.index_offset < sizeof(replay_header_t)
+        || trailer.index_offset + index_size + sizeof(trailer) != reader->size)
+        return -1;
+    if (trailer.count > 0 && (reader->index = mem_alloc(MEM_PLAYBACK, index_size)) == NULL)
+        return -1;
+    reader->index_capacity = trailer.count;
+    memcpy(reader->index, reader->map + trailer.index_offset, index_size);
+    reader->index_count = trailer.count;
+    reader->end = trailer.index_offset;
+    return 0;
+}
+
+int replay_reader_open(replay_reader_t *reader, const char *path) {
+    replay_header_t header;
+    replay_event_t event;
+    struct stat st;
+    size_t next;
+
+    *reader = (replay_reader_t){.fd=-1};
+    if ((reader->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(reader->fd, &st) < 0) {
+        perror(path);
+        replay_reader_close(reader);
+        return -1;
+    }
+    reader->size = st.st_size;
+    if (reader->size < sizeof(header)
+        || (reader->map = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, reader->fd, 0)) == MAP_FAILED) {
+        reader->map = NULL;
+        fprintf(stderr, "[ERROR] Could not map replay: %s\n", path);
+        replay_reader_close(reader);
+        return -1;
+    }
+    memcpy(&header, reader->map, sizeof(header));
+    if (header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION) {
+        fprintf(stderr, "[ERROR] Not a replay log: %s\n", path);
+        replay_reader_close(reader);
+        return -1;
+    }
+    if (replay_load_index(reader) < 0) {
+        fprintf(stderr, "[INFO] Replay %s has no index, scanning it\n", path);
+        if (replay_scan(reader) < 0) {
+            replay_reader_close(reader);
+            return -1;
+        }
+    }
+    // The last keyframe is at most one interval from the end
+    reader->cursor = reader->index_count ? reader->index[reader->index_count - 1].offset : sizeof(header);
+    while (replay_decode(reader, reader->cursor, &event, &next)) {
+        reader->duration_us = event.time_us;
+        reader->cursor = next;
+    }
+    reader->cursor = sizeof(header);
+    return 0;
+}
+
+void replay_reader_close(replay_reader_t *reader) {
+    if (reader->map != NULL)
+        munmap((void *)reader->map, reader->size);
+    if (reader->fd >= 0)
+        close(reader->fd);
+    mem_free(MEM_PLAYBACK, reader->index, reader->index_capacity * sizeof(replay_index_t));
+    *reader = (replay_reader_t){.fd=-1};
+}
+
+int replay_next(replay_reader_t *reader, replay_event_t *event) {
+    size_t next;
+
+    if (!replay_decode(reader, reader->cursor, event, &next))
+        return 0;
+    reader->cursor = next;
+    return 1;
+}
+
+void replay_seek(replay_reader_t *reader, uint32_t time_us) {
+    size_t low = 0;
+    size_t high = reader->index_count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        if (reader->index[mid].time_us <= time_us)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    reader->cursor = low == 0 ? sizeof(replay_header_t) : reader->index[low - 1].offset;
+}
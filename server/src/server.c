@@ -1,17 +1,32 @@
 #include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/sockios.h>
 #include <memory.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <poll.h>
 #include <unistd.h>
 
+#include "budget.h"
+#include "gateway.h"
+#include "leaderboard.h"
+#include "metrics.h"
 #include "packet.h"
+#include "reactor.h"
+#include "replay.h"
 
 #define     MAX_PLAYERS         4
 #define     MIN_PLAYERS         2
@@ -19,13 +34,67 @@
 #define     GAME_WAITTING_TIME  15
 #define     GAME_RUNNING_TIME   60
 
+#define     NS_PER_SEC          1000000000ll
+#define     NS_PER_MS           1000000ll
+
+// Clock probes: one ping per second, and one-way latency compensation is
+// capped so a client cannot buy itself extra time by delaying its pongs
+#define     PING_INTERVAL       (1 * NS_PER_SEC)
+#define     MAX_COMPENSATION    (250 * NS_PER_MS)
+// Clocks further apart than this are not clocks: the pong is forged
+#define     MAX_CLOCK_OFFSET    (100ll * 365 * 24 * 3600 * NS_PER_SEC)
+
+// Character-level progress is folded per player and fanned out at this rate
+#define     PROGRESS_TICK       (50 * NS_PER_MS)
+
 typedef struct linked_word_s
 {
     int                     size;
+    uint32_t                hash;
     char                    word[MAX_STRING_SIZE];
     struct linked_word_s   *next;
 } linked_word_t;
 
+// Datagram channel of a player: offered on join if asked for, ready once
+// the client's UDP_HELLO told us where to send
+typedef enum udp_state_e {
+    UDP_NONE,
+    UDP_OFFERED,
+    UDP_READY,
+} udp_state_t;
+
+typedef struct udp_channel_s
+{
+    udp_state_t         state;
+    uint32_t            token;
+    uint32_t            seq_out;
+    uint32_t            seq_in;
+    struct sockaddr_in  addr;
+} udp_channel_t;
+
+// Characters typed in the current word, for players streaming progress
+typedef struct progress_s
+{
+    int     enabled;
+    int     chars;
+    int     sent_word;
+    int     sent_chars;
+} progress_t;
+
+// A player whose connection broke keeps its seat for SESSION_GRACE. The
+// ordered packets sent to it are kept meanwhile, so a client reconnecting
+// with the token is replayed exactly what it missed.
+#define     SESSION_BACKLOG     64
+#define     SESSION_GRACE       (10 * NS_PER_SEC)
+
+typedef struct session_s
+{
+    uint64_t    token;
+    uint32_t    sent;
+    int64_t     detached_until;
+    packet_t    backlog[SESSION_BACKLOG];
+} session_t;
+
 typedef struct player_s
 {
     player_info_t   info;
@@ -34,30 +103,98 @@ typedef struct player_s
     int             start_words;
     char            name[MAX_PLAYER_NAME_SIZE];
     linked_word_t  *current;
+    linked_word_t  *typing;
+    int             typed_chars;
+    uint32_t        keys;
+    uint32_t        errors;
+    int64_t         srtt;
+    int64_t         offset;
+    int64_t         next_ping;
+    int64_t         scored_at;
+    int             place;
+    int             flagged;
+    udp_channel_t   udp;
+    progress_t      progress;
+    session_t       session;
 } player_t;
 
 #define     MAX_SCORE   50
 
+// Racers best first, equal scores in the order they were reached. Each
+// score knows where its run of racers starts, so a completion finds its new
+// place without scanning.
+typedef struct standings_s
+{
+    player_t   *players[MAX_PLAYERS];
+    int         count;
+    int         first[MAX_SCORE + 2];
+    int         holders[MAX_SCORE + 2];
+} standings_t;
+
 #define     FLAG_BROKEN_SOCK    0x01
 #define     FLAG_CHANGE_MODE    0x02
+#define     FLAG_HANDOFF        0x04
+#define     FLAG_HANDED_OFF     0x08
+#define     FLAG_DRAINING       0x10
+
+// Recorded players are shown next to the viewer, out of their id range.
+// A client holds MAX_PLAYERS rows, its own among them: viewers are not
+// shown to each other and extra recorded players wait for a free row.
+#define     REPLAY_ID_OFFSET    100000
+#define     PLAYBACK_SHOWN      (MAX_PLAYERS - 1)
+
+typedef struct playback_s
+{
+    replay_reader_t reader;
+    double          speed;
+    uint32_t        from_us;
+    int64_t         started;
+    int64_t         restart;
+    int             pending;
+    replay_event_t  event;
+    replay_status_t status;
+    int64_t         status_at;
+    replay_player_t players[PLAYBACK_SHOWN];
+    int             count;
+} playback_t;
 
 typedef struct game_server_s
 {
     game_state_t    state;
-    int             time_remain;
+    int64_t         deadline;
+    int64_t         started;
+    int64_t         next_progress;
     int             running;
     player_t        players[MAX_PLAYERS];
     int             player_count;
-    fd_set          rd_set;
+    reactor_t       reactor;
     int             socket;
+    int             udp;
     int             await;
+    int             admin;
+    const char     *admin_path;
+    int             upgrade;
+    const char     *upgrade_path;
+    int             handoff;
+    int             gateway;
+    const char     *gateway_path;
+    int             gateway_id;
+    int             gateway_load;
+    const char     *store_dir;
     int             flags;
+    arena_t         arena;
     linked_word_t  *words;
     linked_word_t  *last;
+    const char     *log_dir;
+    replay_writer_t log;
+    int             races;
+    playback_t     *playback;
+    leaderboard_t   board;
+    standings_t     standings;
 } game_server_t;
 
 static inline int min(int a, int b) {
-    return b > a ? b : a;
+    return b < a ? b : a;
 }
 
 
@@ -68,7 +205,31 @@ void game_server_destroy(game_server_t *game);
 void game_start(game_server_t *game);
 void game_end(game_server_t *game, player_t *winner);
 void game_player_remove(game_server_t *game, player_t *player);
+void game_player_detach(game_server_t *game, player_t *player);
 void game_handle_packet(game_server_t *game, int socket, const packet_t *packet);
+void game_log_open(game_server_t *game, int64_t now);
+void game_log_close(game_server_t *game, int64_t now);
+void game_log_keyframe(game_server_t *game, int64_t now);
+void playback_join(game_server_t *game, player_t *viewer, int64_t now);
+void playback_send_status(game_server_t *game, player_t *viewer, int64_t now);
+void playback_tick(game_server_t *game, int64_t now);
+void playback_destroy(game_server_t *game);
+void game_handoff(game_server_t *game);
+int handoff_receive(game_server_t *game, const char *path);
+int handoff_listen(const char *path);
+void handoff_released(game_server_t *game);
+int gateway_connect(game_server_t *game, const char *path);
+void gateway_read(game_server_t *game);
+void gateway_report(game_server_t *game);
+uint64_t gateway_token(game_server_t *game, uint64_t token);
+void game_drain(game_server_t *game);
+void player_handle_progress(game_server_t *game, player_t *player, const client_progress_t *progress);
+void player_handle_typing_summary(game_server_t *game, player_t *player, const client_typing_summary_t *summary);
+void player_send_leaderboard(game_server_t *game, player_t *player, uint32_t count);
+void game_player_resume(game_server_t *game, int socket, const client_resume_t *resume);
+void game_record_results(game_server_t *game, player_t *winner, int64_t now);
+player_t *game_find_player(game_server_t *game, int socket);
+player_t *game_find_player_token(game_server_t *game, uint32_t token);
 
 
 
@@ -80,7 +241,8 @@ char BUFFER[BUFFER_SIZE + 1];
 
 static const char DELIMITER[] = " ,.\n";
 
-linked_word_t *word_list_create(const char *filename) {
+// Nodes live in the room's arena, and go away with it
+linked_word_t *word_list_create(arena_t *arena, const char *filename) {
     int fd = open(filename, O_RDONLY);
     ssize_t size;
     char *pch;
@@ -99,14 +261,15 @@ linked_word_t *word_list_create(const char *filename) {
         BUFFER[size] = 0;
         pch = strtok(BUFFER, DELIMITER);
         while (pch != NULL) {
-            last = (last->next = malloc(sizeof(linked_word_t)));
+            last = (last->next = arena_alloc(arena, sizeof(linked_word_t)));
             if (last == NULL) {
                 close(fd);
-                perror("malloc");
+                fprintf(stderr, "[ERROR] Word list over the memory budget: %s\n", filename);
                 exit(EXIT_FAILURE);
             }
             last->size = min(strlen(pch), MAX_STRING_SIZE);
             strncpy(last->word, pch, last->size);
+            last->hash = packet_word_hash(last->word);
             pch = strtok(NULL, DELIMITER);
         }
     } while (size != 0);
@@ -115,24 +278,42 @@ linked_word_t *word_list_create(const char *filename) {
     return list.next;
 }
 
-void word_list_destroy(linked_word_t *list) {
-    linked_word_t *actual = list;
-    linked_word_t *next;
+// Position of a word in the list, which is all another process built from
+// the same file needs to find it again
+int word_list_index(const linked_word_t *list, const linked_word_t *word) {
+    int idx = 0;
+
+    if (word == NULL)
+        return -1;
+    for (const linked_word_t *actual = list; actual != word; actual = actual->next)
+        if (actual->next == list)
+            return -1;
+        else
+            idx++;
+    return idx;
+}
 
-    if (list == NULL)
-        return;
-    while ((next = actual->next) != list) {
-        free(actual);
-        actual = next;
-    }
-    free(actual);
+linked_word_t *word_list_at(linked_word_t *list, int idx) {
+    if (idx < 0)
+        return NULL;
+    while (idx-- > 0)
+        list = list->next;
+    return list;
 }
 
 
 
 /////////// NETWORK ////////////
 
-static int MAX_FD = -1;
+// Bytes of a partially received packet, per socket
+typedef struct connection_s
+{
+    int     open;
+    size_t  filled;
+    char    pending[sizeof(packet_t)];
+} connection_t;
+
+static connection_t CONNECTIONS[FD_SETSIZE];
 
 void net_init(game_server_t *game, const char *host, int port) {
     int sockfd;
@@ -151,74 +332,301 @@ void net_init(game_server_t *game, const char *host, int port) {
         game_server_destroy(game);
         exit(EXIT_FAILURE);
     }
-    if (listen(sockfd, SOMAXCONN) < 0) {
+    if (listen(sockfd, SOMAXCONN) < 0 || reactor_listen(&game->reactor, sockfd) < 0) {
         perror("listen");
         game_server_destroy(game);
         exit(EXIT_FAILURE);
     }
     printf("[INFO] Server listening on %s:%d\n", host, port);
-    game->socket = MAX_FD = sockfd;
+    game->socket = sockfd;
+    // Clients behind a gateway only know its address
+    if (game->gateway_path != NULL)
+        return;
+
+    // The datagram channel is optional: without it everything stays on TCP
+    if ((sockfd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP)) < 0
+        || bind(sockfd, (struct sockaddr *)&serv, sizeof(serv)) < 0
+        || reactor_poll(&game->reactor, sockfd) < 0) {
+        perror("udp");
+        if (sockfd >= 0)
+            close(sockfd);
+        return;
+    }
+    printf("[INFO] Datagrams accepted on %s:%d\n", host, port);
+    game->udp = sockfd;
+}
+
+void net_close(game_server_t *game, int socket) {
+    if (socket < 0)
+        return;
+    if (socket < FD_SETSIZE)
+        CONNECTIONS[socket].open = 0;
+    reactor_close(&game->reactor, socket);
+}
+
+void net_client_evict(game_server_t *game, int socket) {
+    METRICS.evictions++;
+    if (socket == game->await)
+        game->await = -1;
+    net_close(game, socket);
+}
+
+static ssize_t net_write_packet(game_server_t *game, int socket, const packet_t *packet) {
+    ssize_t size = reactor_send(&game->reactor, socket, packet, sizeof(packet_t));
+
+    if (size > 0)
+        metrics_packet_out(packet->id, size);
+    else
+        METRICS.broken_sockets++;
+    return size;
+}
+
+// Kept whether or not the write goes through: bytes accepted by the kernel
+// are still lost if the connection dies before they are delivered
+static void session_record(player_t *player, const packet_t *packet) {
+    if (player->session.token == 0 || !packet_replayed(packet->id))
+        return;
+    player->session.backlog[player->session.sent++ % SESSION_BACKLOG] = *packet;
 }
 
 void net_broadcast_packet(game_server_t *game, const packet_t *packet, int except_id) {
     printf("Broadcast packet %d to %d players except player %d\n", packet->id, game->player_count, except_id);
-    for (int i = 0; i < game->player_count; ++i)
-        if (game->players[i].info.player_id != except_id && game->players[i].status == STABLE
-            && write(game->players[i].socket, packet, sizeof(packet_t)) < 0) {
+    for (int i = 0; i < game->player_count; ++i) {
+        if (game->players[i].info.player_id == except_id)
+            continue;
+        session_record(game->players + i, packet);
+        if (game->players[i].status == STABLE && net_write_packet(game, game->players[i].socket, packet) < 0) {
                 game->players[i].status = BROKEN;
                 game->flags |= FLAG_BROKEN_SOCK;
             }
             // game_handle_packet(game, game->players[i--].socket, &(packet_t){.id=CLIENT_DISCONNECT, .packet.client.player_leave={.reason="Lost connection"}});
+    }
 }
 
 void net_send_packet(game_server_t *game, const packet_t *packet, player_t *player) {
     printf("Sending packet %d to player %d\n", packet->id, player->info.player_id);
-    if (player->status == STABLE && write(player->socket, packet, sizeof(packet_t)) < 0) {
+    session_record(player, packet);
+    if (player->status == STABLE && net_write_packet(game, player->socket, packet) < 0) {
         player->status = BROKEN;
         game->flags |= FLAG_BROKEN_SOCK;
     }
             // game_handle_packet(game, player->socket, &(packet_t){.id=CLIENT_DISCONNECT, .packet.client.player_leave={.reason="Lost connection"}});
 }
 
-void net_client_accept(game_server_t *game) {
-    int socket;
+// Fire and forget, < 0 when the player has no usable datagram channel
+ssize_t net_send_datagram(game_server_t *game, const packet_t *packet, player_t *player) {
+    datagram_t datagram = {.token=player->udp.token, .packet=*packet};
+    ssize_t size;
+
+    if (player->udp.state != UDP_READY || player->status != STABLE)
+        return -1;
+    datagram.seq = ++player->udp.seq_out;
+    METRICS.syscalls++;
+    size = sendto(game->udp, &datagram, sizeof(datagram), MSG_DONTWAIT,
+        (struct sockaddr *)&player->udp.addr, sizeof(player->udp.addr));
+    if (size > 0)
+        metrics_packet_out(packet->id, size);
+    return size;
+}
+
+// Latest-value-wins state: datagrams where possible, the stream otherwise
+void net_broadcast_state(game_server_t *game, const packet_t *packet) {
+    for (int i = 0; i < game->player_count; ++i)
+        if (net_send_datagram(game, packet, game->players + i) < 0)
+            net_send_packet(game, packet, game->players + i);
+}
+
+void net_client_accept(void *ctx, int listener, int socket) {
+    game_server_t *game = ctx;
     struct sockaddr_in clnt;
     socklen_t sin_siz = sizeof(clnt);
+    int one = 1;
 
-    if ((socket = accept(game->socket, (struct sockaddr *)&clnt, &sin_siz)) < 0) {
-        perror("accept");
-        game_server_destroy(game);
-        exit(EXIT_FAILURE);
+    if (listener == game->admin) {
+        admin_serve(socket);
+        return;
+    }
+    // A new binary asking to take over, served between two loop iterations
+    if (listener == game->upgrade) {
+        if (game->handoff != -1 || game->playback != NULL)
+            close(socket);
+        else {
+            game->handoff = socket;
+            game->flags |= FLAG_HANDOFF;
+        }
+        return;
+    }
+    if (socket >= FD_SETSIZE || reactor_watch(&game->reactor, socket) < 0) {
+        fprintf(stderr, "[ERROR] Could not watch socket: %d\n", socket);
+        close(socket);
+        METRICS.evictions++;
+        return;
     }
     if (game->await != -1) {
-        close(game->await);
-        FD_CLR(game->await, &game->rd_set);
         printf("[INFO] Awaitting client on socket %d has expired\n", game->await);
+        net_client_evict(game, game->await);
     }
+    // Packets are tiny and latency bound, Nagle would hold them for an ACK
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    METRICS.connections++;
+    CONNECTIONS[socket] = (connection_t){.open=1, .filled=0};
     game->await = socket;
-    if (socket > MAX_FD)
-        MAX_FD = socket;
+    getpeername(socket, (struct sockaddr *)&clnt, &sin_siz);
     printf("[INFO] Connection from %s:%d\n", inet_ntoa(clnt.sin_addr), ntohs(clnt.sin_port));
 }
 
-net_status_t net_client_read(game_server_t *game, int socket) {
-    static packet_t packet;
+void net_client_status(game_server_t *game, int socket, net_status_t status) {
+    player_t *player = game_find_player(game, socket);
+
+    if (player != NULL) {
+        player->status = status;
+        game->flags |= FLAG_BROKEN_SOCK;
+    } else if (socket == game->await) {
+        net_close(game, game->await);
+        game->await = -1;
+    }
+}
+
+// Reassembles packets from whatever the reactor delivered
+void net_client_read(void *ctx, int socket, const char *data, ssize_t size) {
+    game_server_t *game = ctx;
+    connection_t *conn = CONNECTIONS + socket;
+    packet_t packet;
+    size_t chunk;
+
+    if (size == 0) {
+        printf("[INFO] Connection closed on socket: %d\n", socket);
+        net_client_status(game, socket, CLOSING);
+        return;
+    }
+    if (size < 0) {
+        fprintf(stderr, "[ERROR] Could not read socket: %d\n", socket);
+        METRICS.broken_sockets++;
+        net_client_status(game, socket, BROKEN);
+        return;
+    }
+    while (size > 0 && conn->open) {
+        chunk = sizeof(packet_t) - conn->filled;
+        if (chunk > (size_t)size)
+            chunk = size;
+        memcpy(conn->pending + conn->filled, data, chunk);
+        conn->filled += chunk;
+        data += chunk;
+        size -= chunk;
+        if (conn->filled < sizeof(packet_t))
+            break;
+        conn->filled = 0;
+        memcpy(&packet, conn->pending, sizeof(packet_t));
+        metrics_packet_in(packet.id, sizeof(packet_t));
+        // Out of step or not speaking the protocol: nothing after it can be trusted
+        if (!packet_from_client(packet.id)) {
+            fprintf(stderr, "[ERROR] Invalid packet %d on socket %d\n", packet.id, socket);
+            METRICS.protocol_errors++;
+            net_client_status(game, socket, BROKEN);
+            return;
+        }
+        game_handle_packet(game, socket, &packet);
+    }
+}
+
+void net_client_send_error(void *ctx, int socket) {
+    METRICS.broken_sockets++;
+    net_client_status(ctx, socket, BROKEN);
+}
+
+void net_handle_datagram(game_server_t *game, player_t *player, const datagram_t *datagram, const struct sockaddr_in *from) {
+    switch (datagram->packet.id)
+    {
+    case UDP_HELLO:
+        // Repeated until acknowledged, so it may also refresh a NAT mapping
+        player->udp.addr = *from;
+        player->udp.state = UDP_READY;
+        player->udp.seq_in = datagram->seq;
+        net_send_datagram(game, &(packet_t){.id=UDP_HELLO}, player);
+        break;
+
+    case CLIENT_PROGRESS:
+        player_handle_progress(game, player, &datagram->packet.packet.client.progress);
+        break;
+
+    default:
+        METRICS.datagrams_rejected++;
+    }
+}
+
+void net_datagram_read(game_server_t *game, int socket) {
+    struct sockaddr_in from;
+    socklen_t from_size;
+    datagram_t datagram;
+    player_t *player;
     ssize_t size;
 
-    if ((size = read(socket, &packet, sizeof(packet_t))) != sizeof(packet_t)) {
-        if (size == 0) {
-            printf("[INFO] Connection closed on socket: %d\n", socket);
-            return CLOSING;
+    for (;;) {
+        from_size = sizeof(from);
+        METRICS.syscalls++;
+        if ((size = recvfrom(socket, &datagram, sizeof(datagram), MSG_DONTWAIT, (struct sockaddr *)&from, &from_size)) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("recvfrom");
+            return;
         }
-        if (size < 0) {
-            fprintf(stderr, "[ERROR] Could not read socket: %d\n", socket);
-            game->flags |= FLAG_BROKEN_SOCK;
-            return BROKEN;
+        if (size != sizeof(datagram) || (player = game_find_player_token(game, datagram.token)) == NULL) {
+            METRICS.datagrams_rejected++;
+            continue;
         }
-        printf("[INFO] Invalid packet size (%ld) on socket: %d\n", size, socket);
-    } else
-        game_handle_packet(game, socket, &packet);
-    return STABLE;
+        metrics_packet_in(datagram.packet.id, size);
+        if (player->udp.state == UDP_READY && datagram.packet.id != UDP_HELLO) {
+            if (from.sin_addr.s_addr != player->udp.addr.sin_addr.s_addr || from.sin_port != player->udp.addr.sin_port) {
+                METRICS.datagrams_rejected++;
+                continue;
+            }
+            if (datagram_stale(datagram.seq, player->udp.seq_in)) {
+                METRICS.datagrams_stale++;
+                continue;
+            }
+            player->udp.seq_in = datagram.seq;
+        }
+        net_handle_datagram(game, player, &datagram, &from);
+    }
+}
+
+void net_readable(void *ctx, int socket) {
+    game_server_t *game = ctx;
+
+    if (socket == game->udp)
+        net_datagram_read(game, socket);
+    else if (socket == game->handoff)
+        handoff_released(game);
+    else if (socket == game->gateway)
+        gateway_read(game);
+}
+
+// Kernel send queue depth, sampled at most once per second so it stays cheap
+void net_sample_outq(game_server_t *game) {
+    static int64_t NEXT_SAMPLE = 0;
+    int64_t now = clock_now_ns();
+    int pending;
+
+    if (now < NEXT_SAMPLE)
+        return;
+    NEXT_SAMPLE = now + NS_PER_SEC;
+    for (int i = 0; i < game->player_count; ++i)
+        if (game->players[i].status == STABLE && ioctl(game->players[i].socket, SIOCOUTQ, &pending) == 0)
+            histogram_record(&METRICS.outq_bytes, pending);
+}
+
+void net_ping_players(game_server_t *game, int64_t now) {
+    for (int i = 0; i < game->player_count; ++i) {
+        if (game->players[i].status != STABLE || now < game->players[i].next_ping)
+            continue;
+        game->players[i].next_ping = now + PING_INTERVAL;
+        net_send_packet(game, &(packet_t){.id=SERVER_PING, .packet.server.ping={.sent=now}}, game->players + i);
+        // Lost score datagrams are only repaired by newer ones: resend them all
+        for (int j = 0; j < game->player_count && game->state == RUNNING; ++j)
+            net_send_datagram(game, &(packet_t){
+                .id=SERVER_PLAYER_UPDATE,
+                .packet.server.player_update=game->players[j].info
+            }, game->players + i);
+    }
 }
 
 void net_loop(game_server_t *game) {
@@ -229,65 +637,175 @@ void net_loop(game_server_t *game) {
     sigaddset(&SIGSET, SIGINT);
     sigaddset(&SIGSET, SIGALRM);
     sigaddset(&SIGSET, SIGWINCH);
+    sigaddset(&SIGSET, SIGUSR1);
 
-    FD_ZERO(&game->rd_set);
-    FD_SET(game->socket, &game->rd_set);
-    if (game->await != -1)
-        FD_SET(game->await, &game->rd_set);
-    for (int i = 0; i < game->player_count; ++i)
-        FD_SET(game->players[i].socket, &game->rd_set);
-    
-    if (pselect(MAX_FD + 1, &game->rd_set, NULL, NULL, &SELECT_TO, &SIGSET) < 0) {
+    if (reactor_wait(&game->reactor, &SELECT_TO, &SIGSET) < 0) {
         if (!game->running)
             return;
-        perror("select()");
+        perror("reactor_wait()");
         game_server_destroy(game);
         exit(EXIT_FAILURE);
     }
-    for (int i = 0; i < game->player_count; ++i)
-        if (FD_ISSET(game->players[i].socket, &game->rd_set))
-            game->players[i].status = net_client_read(game, game->players[i].socket);
-    if (game->await != -1 && FD_ISSET(game->await, &game->rd_set) && net_client_read(game, game->await) != STABLE) {
-        close(game->await);
-        game->await = -1;
-    }
-    if (FD_ISSET(game->socket, &game->rd_set))
-        net_client_accept(game);
+}
+
+// End of iteration: everything the game produced goes out in one batch
+void net_flush(game_server_t *game) {
+    reactor_flush(&game->reactor);
 }
 
 
 
 /////////// PLAYER ////////////
 
-void player_init(player_t *player, int socket, int start_words, const char name[MAX_PLAYER_NAME_SIZE]) {
-    static int ID = 0;
+// Carried over on upgrades so ids stay unique
+static int NEXT_PLAYER_ID = 0;
 
-    player->info = (player_info_t){.player_id=ID++, .score=0, .mode=SPECTATOR};
+void player_init(player_t *player, int socket, const client_player_infos_t *infos) {
+    player->info = (player_info_t){.player_id=NEXT_PLAYER_ID++, .score=0, .mode=SPECTATOR};
     player->socket = socket;
     player->status = STABLE;
-    player->start_words = start_words;
-    strncpy(player->name, name, MAX_PLAYER_NAME_SIZE);
+    player->start_words = infos->start_words;
+    strncpy(player->name, infos->name, MAX_PLAYER_NAME_SIZE);
     player->current = NULL;
+    player->typing = NULL;
+    player->typed_chars = 0;
+    player->keys = 0;
+    player->errors = 0;
+    player->srtt = 0;
+    player->offset = 0;
+    player->next_ping = 0;
+    player->scored_at = 0;
+    player->place = -1;
+    player->flagged = 0;
+    player->udp = (udp_channel_t){.state=UDP_NONE};
+    player->progress = (progress_t){.enabled=infos->progress != 0};
+    player->session.sent = 0;
+    player->session.detached_until = 0;
+    if (getrandom(&player->session.token, sizeof(player->session.token), 0) != sizeof(player->session.token))
+        player->session.token = 0;
+}
+
+// Connected, or detached but still holding its seat
+static inline int player_reachable(const player_t *player) {
+    return player->status == STABLE || player->session.detached_until != 0;
 }
 
 void player_reset(player_t *player, linked_word_t *list) {
     player->info.score = 0;
     player->info.mode = SPECTATOR;
     player->current = list;
+    player->typing = list;
+    player->typed_chars = 0;
+    player->keys = 0;
+    player->errors = 0;
+    player->scored_at = 0;
+    player->place = -1;
+    player->flagged = 0;
+    player->progress.chars = 0;
+    player->progress.sent_word = 0;
+    player->progress.sent_chars = 0;
 }
 
-void player_destroy(player_t *player) {
+// One-way latency estimate, assuming a symmetric path
+int64_t player_latency(const player_t *player) {
+    int64_t owd = player->srtt / 2;
+
+    return owd > MAX_COMPENSATION ? MAX_COMPENSATION : owd;
+}
+
+void player_handle_pong(player_t *player, const client_pong_t *pong, int64_t now) {
+    int64_t rtt;
+    int64_t sample;
+
+    // Only echoes of our own pings, read on a clock that never ran backwards
+    if (pong->sent <= 0 || pong->sent > now || pong->received < 0)
+        return;
+    rtt = now - pong->sent;
+    sample = pong->received - (pong->sent + rtt / 2);
+    if (sample > MAX_CLOCK_OFFSET || sample < -MAX_CLOCK_OFFSET)
+        return;
+    histogram_record(&METRICS.rtt_us, rtt / 1000);
+    if (player->srtt == 0) {
+        player->srtt = rtt;
+        player->offset = sample;
+        return;
+    }
+    // Offsets from faster than average round trips carry less path asymmetry
+    if (rtt <= player->srtt)
+        player->offset += (sample - player->offset) / 4;
+    player->srtt += (rtt - player->srtt) / 8;
+}
+
+// A completion must name the word being typed, by its hash, and come no
+// faster than a hand can move: every character after the first of a word
+// takes MIN_KEY_INTERVAL_MS, and the race as a whole cannot outrun
+// MAX_KEYS_PER_SEC, with one word of slack for the start. A player failing
+// either is flagged: scoring stops and the race stays out of the board.
+#define     MIN_KEY_INTERVAL_MS 15
+#define     MAX_KEYS_PER_SEC    25
+
+// Cleared by -t, for load generators
+static int TIMING_CHECKS = 1;
+
+int player_verify_completion(game_server_t *game, player_t *player, const client_word_complete_t *complete, int64_t typed_at) {
+    const linked_word_t *word = player->typing;
+    int64_t chars = strnlen(word->word, MAX_STRING_SIZE);
+    const char *reason;
+
+    if (complete->hash != word->hash)
+        reason = "wrong word";
+    else if (!TIMING_CHECKS)
+        return 0;
+    else if (complete->typing_ms < (chars - 1) * MIN_KEY_INTERVAL_MS)
+        reason = "keystrokes too close";
+    else if ((player->typed_chars + chars - MAX_STRING_SIZE) * NS_PER_SEC > (typed_at - game->started) * MAX_KEYS_PER_SEC)
+        reason = "typing too fast";
+    else
+        return 0;
+    player->flagged = 1;
+    METRICS.completions_flagged++;
+    printf("[INFO] %.*s flagged: %s\n", MAX_PLAYER_NAME_SIZE, player->name, reason);
+    return -1;
+}
+
+// Reports for a word the server has already moved past are dropped
+void player_handle_progress(game_server_t *game, player_t *player, const client_progress_t *progress) {
+    if (game->state != RUNNING || !player->progress.enabled || player->info.mode != PLAYER
+        || progress->word != player->info.score || progress->chars >= MAX_STRING_SIZE)
+        return;
+    player->progress.chars = progress->chars;
+}
+
+// Self-reported by the client after a race: only feeds the metrics
+void player_handle_typing_summary(game_server_t *game, player_t *player, const client_typing_summary_t *summary) {
+    if (game->state == RUNNING || player->info.mode != PLAYER || summary->accuracy > 10000)
+        return;
+    histogram_record(&METRICS.typing_wpm, summary->wpm);
+    histogram_record(&METRICS.typing_bigram_ms, summary->bigram_p50);
+    printf("[INFO] %.*s typed %u.%02u wpm (peak %u.%02u), keys %u ms apart\n", MAX_PLAYER_NAME_SIZE, player->name,
+        summary->wpm / 100, summary->wpm % 100, summary->peak_wpm / 100, summary->peak_wpm % 100, summary->bigram_p50);
+}
+
+void player_destroy(game_server_t *game, player_t *player) {
     if (player->status != CLOSED) {
-        close(player->socket);
+        net_close(game, player->socket);
         player->socket = -1;
         player->status = CLOSED;
     }
 }
 
+replay_player_t player_replay_info(const player_t *player) {
+    replay_player_t info = {.player_id=player->info.player_id, .score=player->info.score};
+
+    memcpy(info.name, player->name, MAX_PLAYER_NAME_SIZE);
+    return info;
+}
+
 void player_send_word(game_server_t *game, player_t *player) {
     packet_t word_packet = {.id=SERVER_NEW_WORD};
 
     strncpy(word_packet.packet.server.new_word.word, player->current->word, MAX_STRING_SIZE);
+    replay_write_word(&game->log, clock_now_ns(), player->info.player_id, word_packet.packet.server.new_word.word);
     player->current = player->current->next;
     net_send_packet(game, &word_packet, player);
 }
@@ -296,15 +814,49 @@ void player_send_update(game_server_t *game, player_t *player) {
     net_send_packet(game, &(packet_t){.id=SERVER_PLAYER_UPDATE, .packet.server.player_update=player->info}, player);
 }
 
+void player_send_status(game_server_t *game, player_t *player) {
+    int64_t now = clock_now_ns();
+    server_game_status_t status = {.state=game->state, .time_remain=-1, .deadline=0};
+
+    // Viewers of a replay only ever see the recorded race
+    if (game->playback != NULL) {
+        playback_send_status(game, player, now);
+        return;
+    }
+    if (game->deadline != 0) {
+        status.time_remain = game->deadline > now ? (game->deadline - now + NS_PER_SEC - 1) / NS_PER_SEC : 0;
+        status.deadline = game->deadline + player->offset;
+    }
+    net_send_packet(game, &(packet_t){.id=SERVER_GAME_STATUS, .packet.server.game_status=status}, player);
+}
+
+// Deadlines are translated into each receiver's clock, so status is unicast
+void game_broadcast_status(game_server_t *game) {
+    for (int i = 0; i < game->player_count; ++i)
+        player_send_status(game, game->players + i);
+}
+
+void player_offer_udp(game_server_t *game, player_t *player) {
+    if (game->udp == -1 || getrandom(&player->udp.token, sizeof(player->udp.token), 0) != sizeof(player->udp.token))
+        return;
+    player->udp.state = UDP_OFFERED;
+    net_send_packet(game, &(packet_t){.id=SERVER_UDP_OFFER, .packet.server.udp_offer={.token=player->udp.token}}, player);
+}
+
 void player_send_join(game_server_t *game, player_t *player) {
     packet_t join_packet = {.id=SERVER_PLAYER_JOIN, .packet.server.player_join={.join_type=NEW_PLAYER, .info=player->info}};
 
     if (game->state == RUNNING)
-        net_send_packet(game, &(packet_t){.id=SERVER_GAME_STATUS, .packet.server.game_status={.state=game->state, .time_remain=game->time_remain}}, player);
+        player_send_status(game, player);
     else
-        net_broadcast_packet(game, &(packet_t){.id=SERVER_GAME_STATUS, .packet.server.game_status={.state=game->state, .time_remain=game->time_remain}}, -1);
+        game_broadcast_status(game);
     strncpy(join_packet.packet.server.player_join.name, player->name, MAX_PLAYER_NAME_SIZE);
-    net_send_packet(game, &(packet_t){.id=SERVER_PLAYER_ACCEPT, .packet.server.player_accept=player->info}, player);
+    net_send_packet(game, &(packet_t){.id=SERVER_PLAYER_ACCEPT, .packet.server.player_accept={
+        .info=player->info,
+        .token=player->session.token
+    }}, player);
+    if (game->playback != NULL)
+        return;
     net_broadcast_packet(game, &join_packet, player->info.player_id);
     join_packet.packet.server.player_join.join_type=OLD_PLAYER;
     for (int i = 0; i < game->player_count; ++i) {
@@ -318,25 +870,186 @@ void player_send_join(game_server_t *game, player_t *player) {
 
 
 
+/////////// STANDINGS ////////////
+
+void player_send_place(game_server_t *game, player_t *player, const player_t *racer) {
+    net_send_packet(game, &(packet_t){.id=SERVER_PLAYER_PLACE, .packet.server.player_place={
+        .player_id=racer->info.player_id,
+        .place=racer->place + 1
+    }}, player);
+}
+
+// The whole order, for a client that has none yet
+void player_send_standings(game_server_t *game, player_t *player) {
+    for (int i = 0; i < game->standings.count; ++i)
+        player_send_place(game, player, game->standings.players[i]);
+}
+
+// Everyone racing starts level, in join order
+void standings_reset(game_server_t *game) {
+    standings_t *standings = &game->standings;
+
+    memset(standings->holders, 0, sizeof(standings->holders));
+    standings->count = 0;
+    for (int i = 0; i < game->player_count; ++i) {
+        if (game->players[i].info.mode != PLAYER)
+            continue;
+        game->players[i].place = standings->count;
+        standings->players[standings->count++] = game->players + i;
+    }
+    standings->first[0] = 0;
+    standings->holders[0] = standings->count;
+}
+
+// Called once the player's score went up by one: it passes everyone still on
+// its old score, then falls back behind anyone on the new score whose
+// completion was typed later
+void standings_promote(game_server_t *game, player_t *player) {
+    standings_t *standings = &game->standings;
+    int score = player->info.score;
+    int from = player->place;
+    int to;
+
+    if (from < 0 || score > MAX_SCORE + 1)
+        return;
+    to = standings->first[score - 1];
+    standings->first[score - 1]++;
+    standings->holders[score - 1]--;
+    while (to > 0 && standings->players[to - 1]->info.score == score
+        && standings->players[to - 1]->scored_at > player->scored_at)
+        to--;
+    if (standings->holders[score]++ == 0)
+        standings->first[score] = to;
+    if (to == from)
+        return;
+    memmove(standings->players + to + 1, standings->players + to, (from - to) * sizeof(player_t *));
+    standings->players[to] = player;
+    for (int i = to; i <= from; ++i)
+        standings->players[i]->place = i;
+    for (int i = 0; i < game->player_count; ++i)
+        player_send_place(game, game->players + i, player);
+}
+
+// Clients drop a removed racer from their order on their own
+void standings_remove(game_server_t *game, player_t *player) {
+    standings_t *standings = &game->standings;
+    int from = player->place;
+
+    if (from < 0)
+        return;
+    standings->holders[player->info.score]--;
+    for (int score = 0; score < player->info.score; ++score)
+        standings->first[score]--;
+    memmove(standings->players + from, standings->players + from + 1, (standings->count - from - 1) * sizeof(player_t *));
+    standings->count--;
+    for (int i = from; i < standings->count; ++i)
+        standings->players[i]->place = i;
+    player->place = -1;
+}
+
+
+
 /////////// GAME ////////////
 
-void game_server_init(game_server_t *game, const char *host, int port,  const char *filename) {
+void game_server_init(game_server_t *game, const char *host, int port,  const char *filename, const char *admin_path, const char *reactor,
+    const char *log_dir, const char *store_dir, const char *upgrade_path, const char *gateway_path) {
     game->state = WAITTING;
-    game->time_remain = -1;
+    game->deadline = 0;
+    game->started = 0;
+    game->next_progress = 0;
     game->player_count = 0;
-    FD_ZERO(&game->rd_set);
     game->flags = 0;
-    game->words = word_list_create(filename);
+    arena_init(&game->arena, MEM_WORDS);
+    game->words = word_list_create(&game->arena, filename);
     game->last = game->words;
+    game->socket = -1;
+    game->udp = -1;
     game->await = -1;
-    net_init(game, host, port);
+    game->admin = -1;
+    game->admin_path = NULL;
+    game->upgrade = -1;
+    game->upgrade_path = NULL;
+    game->handoff = -1;
+    game->gateway = -1;
+    game->gateway_path = gateway_path;
+    game->gateway_id = 0;
+    game->gateway_load = -1;
+    game->store_dir = store_dir;
+    game->log_dir = log_dir;
+    game->log = (replay_writer_t){.fd=-1};
+    game->races = 0;
+    game->playback = NULL;
+    game->standings.count = 0;
+    game->board = (leaderboard_t){.wal=-1};
+    if (reactor_init(&game->reactor, reactor, (reactor_handler_t){
+        .ctx=game,
+        .accept=net_client_accept,
+        .data=net_client_read,
+        .send_error=net_client_send_error,
+        .readable=net_readable
+    }) < 0)
+        exit(EXIT_FAILURE);
+    // Taking over from a running server, or starting from scratch. The store
+    // is opened once the previous server let go of it.
+    if (upgrade_path == NULL || handoff_receive(game, upgrade_path) < 0) {
+        net_init(game, host, port);
+        if (store_dir != NULL && leaderboard_open(&game->board, store_dir) < 0) {
+            game_server_destroy(game);
+            exit(EXIT_FAILURE);
+        }
+    }
+    // A server taking over kept the previous one's place behind the gateway
+    if (gateway_path != NULL && game->gateway == -1 && gateway_connect(game, gateway_path) < 0) {
+        game_server_destroy(game);
+        exit(EXIT_FAILURE);
+    }
+    // Paths are only ours to unlink once bound: until then they may belong
+    // to the server we failed to take over from
+    if (upgrade_path != NULL && (game->upgrade = handoff_listen(upgrade_path)) != -1) {
+        game->upgrade_path = upgrade_path;
+        reactor_listen(&game->reactor, game->upgrade);
+    }
+    if (admin_path != NULL && (game->admin = admin_init(admin_path)) != -1) {
+        game->admin_path = admin_path;
+        reactor_listen(&game->reactor, game->admin);
+    }
 }
 
 void game_server_destroy(game_server_t *game) {
     for (int i = 0; i < game->player_count; ++i)
-        close(game->players[i].socket);
-    close(game->socket);
-    word_list_destroy(game->words);
+        net_close(game, game->players[i].socket);
+    net_close(game, game->await);
+    reactor_close(&game->reactor, game->socket);
+    reactor_close(&game->reactor, game->udp);
+    reactor_close(&game->reactor, game->admin);
+    reactor_close(&game->reactor, game->upgrade);
+    reactor_close(&game->reactor, game->gateway);
+    // The paths belong to the server we handed off to
+    if (!(game->flags & FLAG_HANDED_OFF)) {
+        admin_destroy(game->admin_path);
+        admin_destroy(game->upgrade_path);
+    }
+    game_log_close(game, clock_now_ns());
+    playback_destroy(game);
+    leaderboard_close(&game->board);
+    // Closing last tells the new server the store is free
+    reactor_close(&game->reactor, game->handoff);
+    reactor_destroy(&game->reactor);
+    arena_release(&game->arena);
+    game->words = NULL;
+}
+
+void game_player_detach(game_server_t *game, player_t *player) {
+    printf("[INFO] %.*s lost connection, seat held for %lld s\n", MAX_PLAYER_NAME_SIZE, player->name, SESSION_GRACE / NS_PER_SEC);
+    player_destroy(game, player);
+    player->session.detached_until = clock_now_ns() + SESSION_GRACE;
+}
+
+// Seats of players that did not come back in time are given up
+void game_expire_sessions(game_server_t *game, int64_t now) {
+    for (int i = game->player_count - 1; i >= 0; --i)
+        if (game->players[i].session.detached_until != 0 && now >= game->players[i].session.detached_until)
+            game_player_remove(game, game->players + i);
 }
 
 void game_server_clean(game_server_t *game) {
@@ -350,33 +1063,91 @@ void game_server_clean(game_server_t *game) {
         
         case BROKEN:
         case CLOSING:
-            game_player_remove(game, game->players + i);
+            if (game->players[i].session.token != 0 && game->playback == NULL)
+                game_player_detach(game, game->players + i);
+            else
+                game_player_remove(game, game->players + i);
         }
     }
 }
 
+// Highest score wins, ties go to whoever scored first on their own clock
 player_t *game_find_winner(game_server_t *game) {
-    player_t *player = game->players;
+    return game->standings.count > 0 ? game->standings.players[0] : NULL;
+}
 
-    if (game->player_count == 0)
-        return NULL;
-    for (int i = 1; i < game->player_count; ++i)
-        if (game->players->info.score > player->info.score)
-            player = game->players + i;
-    return player;
+// Completions sent before the deadline may still be in flight: a race is
+// held open for the slowest player's one-way latency before adjudication
+int64_t game_adjudication_time(game_server_t *game) {
+    int64_t grace = 0;
+
+    if (game->deadline == 0 || game->state != RUNNING)
+        return game->deadline;
+    for (int i = 0; i < game->player_count; ++i)
+        if (player_latency(game->players + i) > grace)
+            grace = player_latency(game->players + i);
+    return game->deadline + grace;
 }
 
+// One packet per tick carrying only the players that moved since the last
+// one, sent to every player that streams progress
+void game_progress_tick(game_server_t *game, int64_t now) {
+    packet_t packet = {.id=SERVER_PROGRESS};
+    server_progress_t *progress = &packet.packet.server.progress;
+    player_t *player;
+
+    if (game->state != RUNNING || now < game->next_progress)
+        return;
+    game->next_progress = now + PROGRESS_TICK;
+    for (int i = 0; i < game->player_count && progress->count < MAX_PROGRESS_ENTRIES; ++i) {
+        player = game->players + i;
+        if (!player->progress.enabled
+            || (player->progress.sent_word == player->info.score && player->progress.sent_chars == player->progress.chars))
+            continue;
+        player->progress.sent_word = player->info.score;
+        player->progress.sent_chars = player->progress.chars;
+        progress_entry_write(progress, player->info.player_id, player->info.score, player->progress.chars);
+    }
+    if (progress->count == 0)
+        return;
+    for (int i = 0; i < game->player_count; ++i)
+        if (game->players[i].progress.enabled && net_send_datagram(game, &packet, game->players + i) < 0)
+            net_send_packet(game, &packet, game->players + i);
+}
+
+// Set on SIGUSR1
+static volatile sig_atomic_t DRAIN = 0;
+
 void game_server_start(game_server_t *game) {
+    int64_t woke;
+
     game->running = 1;
     while (game->running)
     {
         net_loop(game);
+        woke = clock_now_ns();
+        net_sample_outq(game);
+        net_ping_players(game, woke);
+        game_progress_tick(game, woke);
         while (game->flags & FLAG_BROKEN_SOCK)
             game_server_clean(game);
-        if (game->time_remain == 0 || game->flags & FLAG_CHANGE_MODE) {
+        game_expire_sessions(game, woke);
+        gateway_report(game);
+        if (DRAIN)
+            game_drain(game);
+        if (replay_keyframe_due(&game->log, woke))
+            game_log_keyframe(game, woke);
+        if (game->playback != NULL)
+            playback_tick(game, woke);
+        else if ((game->deadline != 0 && woke >= game_adjudication_time(game)) || game->flags & FLAG_CHANGE_MODE) {
             game->flags &= ~FLAG_CHANGE_MODE;
             game->state == RUNNING ? game_end(game, game_find_winner(game)) : game_start(game);
         }
+        net_flush(game);
+        if (game->flags & FLAG_HANDOFF)
+            game_handoff(game);
+        // From the wait's return: dispatch inside the reactor is busy time too
+        histogram_record(&METRICS.loop_busy_ns, clock_now_ns() - game->reactor.woke);
     }
 }
 
@@ -387,6 +1158,13 @@ player_t *game_find_player(game_server_t *game, int socket) {
     return NULL;
 }
 
+player_t *game_find_player_token(game_server_t *game, uint32_t token) {
+    for (int i = 0; i < game->player_count; ++i)
+        if (game->players[i].udp.state != UDP_NONE && game->players[i].udp.token == token)
+            return &game->players[i];
+    return NULL;
+}
+
 int game_find_player_idx(game_server_t *game, int id) {
     for (int i = 0; i < game->player_count; ++i)
         if (game->players[i].info.player_id == id)
@@ -403,48 +1181,130 @@ void game_update_all_players(game_server_t *game) {
 }
 
 void game_start(game_server_t *game) {
+    // Draining lets the running race finish, then the room empties out
+    if (game->flags & FLAG_DRAINING) {
+        game->deadline = 0;
+        game_broadcast_status(game);
+        return;
+    }
+    // Not enough left to see a whole race through: the room waits
+    if (!mem_room_available()) {
+        fprintf(stderr, "[ERROR] Memory budget exhausted, race postponed\n");
+        game->deadline = clock_now_ns() + GAME_WAITTING_TIME * NS_PER_SEC;
+        game_broadcast_status(game);
+        return;
+    }
     game->state = RUNNING;
-    game->time_remain = GAME_RUNNING_TIME;
-    for (int i = 0; i < game->player_count; ++i) {
+    game->started = clock_now_ns();
+    game->deadline = game->started + GAME_RUNNING_TIME * NS_PER_SEC;
+    METRICS.rooms_started++;
+    for (int i = 0; i < game->player_count; ++i)
         player_reset(game->players + i, game->last);
+    game_log_open(game, clock_now_ns());
+    for (int i = 0; i < game->player_count; ++i) {
         game->players[i].info.mode = PLAYER;
-        for (int j = 0; j < game->players[i].start_words && game->players[i].status == STABLE; ++j)
+        for (int j = 0; j < game->players[i].start_words && player_reachable(game->players + i); ++j)
             player_send_word(game, game->players + i);
     }
+    standings_reset(game);
     game_update_all_players(game);
     printf("[INFO] Game has started with %d players\n", game->player_count);
-    net_broadcast_packet(game, &(packet_t){.id=SERVER_GAME_STATUS, .packet.server.game_status={.state=game->state, .time_remain=game->time_remain}}, -1);
+    game_broadcast_status(game);
+    for (int i = 0; i < game->player_count; ++i)
+        player_send_standings(game, game->players + i);
 }
 
 void game_end(game_server_t *game, player_t *winner) {
+    int64_t now = clock_now_ns();
+    // A score win pulls the deadline in: only a race run to its scheduled
+    // end, or a room without a countdown, is left idle
+    int64_t end = game->state == RUNNING ? game->started + GAME_RUNNING_TIME * NS_PER_SEC : game->deadline;
+    int timed_out = end == 0 || now + 2 * NS_PER_SEC > end;
+
     if (game->state == RUNNING) {
+        METRICS.rooms_ended++;
         if (winner == NULL)
             printf("[INFO] Game has ended without winner\n");
         else {
             game->last = winner->current;
             printf("[INFO] Game has ended won by: %.*s\n", MAX_PLAYER_NAME_SIZE, winner->name);
         }
+        game_record_results(game, winner, now);
     }
     game->state = WAITTING;
-    game->time_remain = game->time_remain < 2 ? -1 : GAME_WAITTING_TIME;
-
-    net_broadcast_packet(game, &(packet_t){.id=SERVER_GAME_STATUS, .packet.server.game_status={.state=game->state, .time_remain=game->time_remain}}, -1);
+    game->deadline = timed_out ? 0 : now + GAME_WAITTING_TIME * NS_PER_SEC;
+    game_broadcast_status(game);
+    // Clients stop applying datagrams once waiting: final scores go reliably
+    game_update_all_players(game);
+    game_log_close(game, now);
 }
 
 void game_player_add(game_server_t *game, int socket, const client_player_infos_t *packet) {
     player_t *player = game->players + game->player_count;
+    replay_player_t info;
 
+    if (!packet_string_valid(packet->name, MAX_PLAYER_NAME_SIZE)) {
+        fprintf(stderr, "[ERROR] Invalid player name on socket %d\n", socket);
+        return;
+    }
     if (packet->start_words < MIN_START_WORDS || packet->start_words > MAX_START_WORDS) {
         fprintf(stderr, "[ERROR] Player %.*s asked invalid start words: %d\n", MAX_PLAYER_NAME_SIZE, packet->name, packet->start_words);
         return;
     }
-    player_init(player, socket, packet->start_words, packet->name);
+    player_init(player, socket, packet);
+    player->session.token = gateway_token(game, player->session.token);
     printf("[+] %.*s has joined\n", MAX_PLAYER_NAME_SIZE, packet->name);
     game->player_count++;
     game->await = -1;
-    if (game->state == WAITTING && game->player_count >= MIN_PLAYERS)
-        game->time_remain = GAME_WAITTING_TIME;
+    if (game->state == WAITTING && game->player_count >= MIN_PLAYERS && game->playback == NULL)
+        game->deadline = clock_now_ns() + GAME_WAITTING_TIME * NS_PER_SEC;
     player_send_join(game, player);
+    if (game->state == RUNNING)
+        player_send_standings(game, player);
+    if (packet->udp)
+        player_offer_udp(game, player);
+    info = player_replay_info(player);
+    replay_write_player(&game->log, clock_now_ns(), REPLAY_JOIN, &info);
+    if (game->playback != NULL)
+        playback_join(game, player, clock_now_ns());
+}
+
+player_t *game_find_player_session(game_server_t *game, uint64_t token) {
+    for (int i = 0; i < game->player_count && token != 0; ++i)
+        if (game->players[i].session.token == token)
+            return game->players + i;
+    return NULL;
+}
+
+// The new connection takes over the seat: the ordered packets it missed are
+// replayed from the backlog, then current scores, in a single flush
+void game_player_resume(game_server_t *game, int socket, const client_resume_t *resume) {
+    player_t *player = game_find_player_session(game, resume->token);
+    uint32_t missed = player != NULL ? player->session.sent - resume->received : 0;
+
+    if (player == NULL || missed > SESSION_BACKLOG) {
+        // Too late or too far behind: the client joins from scratch on this connection
+        printf("[INFO] Session resume refused on socket %d\n", socket);
+        if (player != NULL)
+            game_player_remove(game, player);
+        net_write_packet(game, socket, &(packet_t){.id=SERVER_RESUME, .packet.server.resume={.accepted=0}});
+        return;
+    }
+    // The old connection may not have been noticed as broken yet
+    if (player->status != CLOSED)
+        net_close(game, player->socket);
+    game->await = -1;
+    player->socket = socket;
+    player->status = STABLE;
+    player->session.detached_until = 0;
+    player->next_ping = 0;
+    net_write_packet(game, socket, &(packet_t){.id=SERVER_RESUME, .packet.server.resume={.accepted=1, .replayed=missed}});
+    for (uint32_t seq = resume->received; seq != player->session.sent; ++seq)
+        net_write_packet(game, socket, player->session.backlog + seq % SESSION_BACKLOG);
+    for (int i = 0; i < game->player_count; ++i)
+        net_write_packet(game, socket, &(packet_t){.id=SERVER_PLAYER_UPDATE, .packet.server.player_update=game->players[i].info});
+    METRICS.sessions_resumed++;
+    printf("[INFO] %.*s resumed, %u packets replayed\n", MAX_PLAYER_NAME_SIZE, player->name, missed);
 }
 
 void game_player_remove(game_server_t *game, player_t *player) {
@@ -455,13 +1315,17 @@ void game_player_remove(game_server_t *game, player_t *player) {
         return;
     }
     printf("[-] %.*s has left\n", MAX_PLAYER_NAME_SIZE, player->name);
-    FD_CLR(player->socket, &game->rd_set);
-    player_destroy(player);
+    replay_write_player(&game->log, clock_now_ns(), REPLAY_REMOVE, &(replay_player_t){.player_id=player->info.player_id});
+    player_destroy(game, player);
+    standings_remove(game, player);
     net_broadcast_packet(game, &(packet_t){.id=SERVER_PLAYER_REMOVE, .packet.server.player_remove={.player_id=player->info.player_id}}, player->info.player_id);
     game->player_count--;
-    if (idx != game->player_count)
+    if (idx != game->player_count) {
         game->players[idx] = game->players[game->player_count];
-    if (game->player_count < 2)
+        if (game->players[idx].place >= 0)
+            game->standings.players[game->players[idx].place] = game->players + idx;
+    }
+    if (game->player_count < 2 && game->playback == NULL)
         game_end(game, game_find_winner(game));
 }
 
@@ -471,17 +1335,23 @@ void game_handle_packet(game_server_t *game, int socket, const packet_t *packet)
 
     printf("Client %d packet: %d\n", player != NULL ? player->info.player_id : -1, packet->id);
 
+    if (player == NULL && packet->id == CLIENT_RESUME && socket == game->await) {
+        game_player_resume(game, socket, &packet->packet.client.resume);
+        return;
+    }
     if (player == NULL && packet->id != CLIENT_PLAYER_INFOS) {
-        close(socket);
+        net_client_evict(game, socket);
         return;
     }
 
     switch (packet->id)
     {
     case CLIENT_PLAYER_INFOS:
+        // A draining room only takes its own players back, through CLIENT_RESUME
         if (player == NULL) {
-            if (game->player_count == MAX_PLAYERS)
-                close(socket);
+            if (game->player_count == MAX_PLAYERS || game->flags & FLAG_DRAINING
+                || (game->state == WAITTING && !mem_room_available()))
+                net_client_evict(game, socket);
             else
                 game_player_add(game, socket, &packet->packet.client.player_infos);
         }
@@ -489,17 +1359,58 @@ void game_handle_packet(game_server_t *game, int socket, const packet_t *packet)
     
     case CLIENT_WORD_COMPLETE:
         if (game->state == RUNNING && player->info.mode == PLAYER && player->current != NULL) {
-            player->current = player->current->next;
+            int64_t completed = clock_now_ns();
+            int64_t typed_at = completed - player_latency(player);
+
+            // Typed after the (possibly already reached) finish line
+            if (typed_at > game->deadline || player->info.score > MAX_SCORE || player->flagged
+                || player_verify_completion(game, player, &packet->packet.client.word_complete, typed_at) < 0)
+                break;
+            player->typed_chars += strnlen(player->typing->word, MAX_STRING_SIZE);
+            player->typing = player->typing->next;
+            // Cumulative over the race, a reordered or forged decrease is ignored
+            if (packet->packet.client.word_complete.keys >= player->keys) {
+                player->keys = packet->packet.client.word_complete.keys;
+                player->errors = packet->packet.client.word_complete.errors;
+            }
+            player->scored_at = typed_at;
+            player->progress.chars = 0;
+            METRICS.words_completed++;
             if (player->info.score++ >= MAX_SCORE)
-                game_end(game, player);
-            else {
-                net_broadcast_packet(game, &(packet_t){.id=SERVER_PLAYER_UPDATE, .packet.server.player_update=player->info}, -1);
+                game->deadline = typed_at;
+            replay_write_player(&game->log, completed, REPLAY_COMPLETE, &(replay_player_t){
+                .player_id=player->info.player_id,
+                .score=player->info.score
+            });
+            net_broadcast_state(game, &(packet_t){.id=SERVER_PLAYER_UPDATE, .packet.server.player_update=player->info});
+            standings_promote(game, player);
+            if (player->info.score <= MAX_SCORE) {
                 player_send_word(game, player);
+                histogram_record(&METRICS.word_latency_us, (clock_now_ns() - completed) / 1000);
             }
         }
         break;
+
+    case CLIENT_PONG:
+        player_handle_pong(player, &packet->packet.client.pong, clock_now_ns());
+        break;
+
+    case CLIENT_PROGRESS:
+        player_handle_progress(game, player, &packet->packet.client.progress);
+        break;
+
+    case CLIENT_LEADERBOARD:
+        player_send_leaderboard(game, player, packet->packet.client.leaderboard.count);
+        break;
+
+    case CLIENT_TYPING_SUMMARY:
+        player_handle_typing_summary(game, player, &packet->packet.client.typing_summary);
+        break;
     
     case CLIENT_DISCONNECT:
+        if (packet_string_valid(packet->packet.client.player_leave.reason, MAX_STRING_SIZE))
+            printf("[INFO] %.*s leaves: %.*s\n", MAX_PLAYER_NAME_SIZE, player->name,
+                MAX_STRING_SIZE, packet->packet.client.player_leave.reason);
         game_player_remove(game, player);
         break;
     
@@ -510,14 +1421,781 @@ void game_handle_packet(game_server_t *game, int socket, const packet_t *packet)
 
 
 
-/////////// SIGNAL & CLOCK ////////////
+/////////// REPLAY ////////////
+
+void game_log_keyframe(game_server_t *game, int64_t now) {
+    replay_player_t players[MAX_PLAYERS];
+
+    for (int i = 0; i < game->player_count; ++i)
+        players[i] = player_replay_info(game->players + i);
+    replay_write_keyframe(&game->log, now, game->state, game->deadline, players, game->player_count);
+}
+
+// One log per race, opened once the room is reset and closed at its end
+void game_log_open(game_server_t *game, int64_t now) {
+    char path[PATH_MAX];
+
+    if (game->log_dir == NULL)
+        return;
+    snprintf(path, sizeof(path), "%s/race-%ld-%d.trl", game->log_dir, (long)time(NULL), ++game->races);
+    if (replay_writer_open(&game->log, path, now) < 0)
+        return;
+    printf("[INFO] Recording race to %s\n", path);
+    game_log_keyframe(game, now);
+}
+
+void game_log_close(game_server_t *game, int64_t now) {
+    if (game->log.map == NULL)
+        return;
+    replay_write_status(&game->log, now, game->state, game->deadline);
+    replay_writer_close(&game->log);
+}
+
+void playback_init(game_server_t *game, const char *path, double speed, double from) {
+    playback_t *playback = mem_alloc(MEM_PLAYBACK, sizeof(playback_t));
+
+    if (playback == NULL || replay_reader_open(&playback->reader, path) < 0) {
+        mem_free(MEM_PLAYBACK, playback, sizeof(playback_t));
+        game_server_destroy(game);
+        exit(EXIT_FAILURE);
+    }
+    playback->speed = speed;
+    playback->from_us = from * 1000000;
+    playback->status = (replay_status_t){.state=WAITTING, .remain_ms=REPLAY_PAUSED};
+    game->playback = playback;
+    printf("[INFO] Replaying %s (%u s, %zu keyframes) at %gx from %g s\n", path,
+        playback->reader.duration_us / 1000000, playback->reader.index_count, speed, from);
+}
+
+void playback_destroy(game_server_t *game) {
+    if (game->playback == NULL)
+        return;
+    replay_reader_close(&game->playback->reader);
+    mem_free(MEM_PLAYBACK, game->playback, sizeof(playback_t));
+    game->playback = NULL;
+}
+
+// Wall clock time at which an event of the log is played
+static int64_t playback_clock(const playback_t *playback, uint32_t time_us) {
+    return playback->started + (int64_t)(((int64_t)time_us - playback->from_us) * 1000 / playback->speed);
+}
+
+void playback_send_status(game_server_t *game, player_t *viewer, int64_t now) {
+    playback_t *playback = game->playback;
+    server_game_status_t status = {.state=playback->status.state, .time_remain=-1, .deadline=0};
+    int64_t left;
+
+    if (playback->status.remain_ms != REPLAY_PAUSED) {
+        left = playback->status.remain_ms * NS_PER_MS / playback->speed - (now - playback->status_at);
+        if (left < 0)
+            left = 0;
+        status.time_remain = (left + NS_PER_SEC - 1) / NS_PER_SEC;
+        status.deadline = now + left + viewer->offset;
+    }
+    net_send_packet(game, &(packet_t){.id=SERVER_GAME_STATUS, .packet.server.game_status=status}, viewer);
+}
+
+// To one viewer, or to all of them without one
+static void playback_send_join(game_server_t *game, const replay_player_t *player, join_type_t type, player_t *viewer) {
+    packet_t packet = {.id=SERVER_PLAYER_JOIN, .packet.server.player_join={
+        .info={.player_id=player->player_id + REPLAY_ID_OFFSET, .mode=PLAYER, .score=player->score},
+        .join_type=type
+    }};
+
+    memcpy(packet.packet.server.player_join.name, player->name, MAX_PLAYER_NAME_SIZE);
+    if (viewer != NULL)
+        net_send_packet(game, &packet, viewer);
+    else
+        net_broadcast_packet(game, &packet, -1);
+}
+
+void playback_sync(game_server_t *game, player_t *viewer, int64_t now) {
+    playback_t *playback = game->playback;
+
+    for (int i = 0; i < playback->count; ++i)
+        playback_send_join(game, playback->players + i, OLD_PLAYER, viewer);
+    playback_send_status(game, viewer, now);
+}
+
+static void playback_remove(game_server_t *game, int idx, int emit) {
+    playback_t *playback = game->playback;
+
+    if (emit)
+        net_broadcast_packet(game, &(packet_t){.id=SERVER_PLAYER_REMOVE, .packet.server.player_remove={
+            .player_id=playback->players[idx].player_id + REPLAY_ID_OFFSET
+        }}, -1);
+    playback->players[idx] = playback->players[--playback->count];
+}
+
+static int playback_find(const playback_t *playback, int player_id) {
+    for (int i = 0; i < playback->count; ++i)
+        if (playback->players[i].player_id == player_id)
+            return i;
+    return -1;
+}
+
+static void playback_score(game_server_t *game, int idx, int score, int emit) {
+    replay_player_t *player = game->playback->players + idx;
+
+    if (player->score == score)
+        return;
+    player->score = score;
+    if (emit)
+        net_broadcast_packet(game, &(packet_t){.id=SERVER_PLAYER_UPDATE, .packet.server.player_update={
+            .player_id=player->player_id + REPLAY_ID_OFFSET,
+            .mode=PLAYER,
+            .score=score
+        }}, -1);
+}
+
+// Keyframes bring the room to their state, which is a no-op when nothing
+// was lost in between
+static void playback_keyframe(game_server_t *game, const replay_event_t *event, int emit) {
+    playback_t *playback = game->playback;
+    int idx;
+
+    for (int i = playback->count - 1; i >= 0; --i) {
+        int found = 0;
+
+        for (int j = 0; j < event->count && !found; ++j)
+            found = event->players[j].player_id == playback->players[i].player_id;
+        if (!found)
+            playback_remove(game, i, emit);
+    }
+    for (int j = 0; j < event->count; ++j) {
+        if ((idx = playback_find(playback, event->players[j].player_id)) != -1)
+            playback_score(game, idx, event->players[j].score, emit);
+        else if (playback->count < PLAYBACK_SHOWN) {
+            playback->players[playback->count++] = event->players[j];
+            if (emit)
+                playback_send_join(game, event->players + j, NEW_PLAYER, NULL);
+        }
+    }
+}
+
+static void playback_apply(game_server_t *game, const replay_event_t *event, int emit) {
+    playback_t *playback = game->playback;
+    int changed = event->status.state != playback->status.state;
+    int idx;
+
+    switch (event->type)
+    {
+    case REPLAY_KEYFRAME:
+        playback_keyframe(game, event, emit);
+        // Keyframes only carry the deadline forward, they don't rebroadcast it
+        playback->status = event->status;
+        playback->status_at = playback_clock(playback, event->time_us);
+        if (emit && changed)
+            game_broadcast_status(game);
+        break;
+
+    case REPLAY_STATUS:
+        playback->status = event->status;
+        playback->status_at = playback_clock(playback, event->time_us);
+        if (emit)
+            game_broadcast_status(game);
+        break;
+
+    case REPLAY_JOIN:
+        if (playback_find(playback, event->player.player_id) != -1 || playback->count == PLAYBACK_SHOWN)
+            break;
+        playback->players[playback->count++] = event->player;
+        if (emit)
+            playback_send_join(game, &event->player, NEW_PLAYER, NULL);
+        break;
+
+    case REPLAY_REMOVE:
+        if ((idx = playback_find(playback, event->player.player_id)) != -1)
+            playback_remove(game, idx, emit);
+        break;
+
+    case REPLAY_COMPLETE:
+        if ((idx = playback_find(playback, event->player.player_id)) != -1)
+            playback_score(game, idx, event->player.score, emit);
+        break;
+
+    case REPLAY_WORD:
+        break;
+    }
+}
+
+// Seeks to the nearest keyframe and silently catches up to the start point
+void playback_start(game_server_t *game, int64_t now) {
+    playback_t *playback = game->playback;
+
+    replay_seek(&playback->reader, playback->from_us);
+    playback->started = now;
+    playback->restart = 0;
+    playback->count = 0;
+    playback->status = (replay_status_t){.state=WAITTING, .remain_ms=REPLAY_PAUSED};
+    playback->status_at = now;
+    while ((playback->pending = replay_next(&playback->reader, &playback->event))
+        && playback->event.time_us <= playback->from_us)
+        playback_apply(game, &playback->event, 0);
+    for (int i = 0; i < game->player_count; ++i)
+        playback_sync(game, game->players + i, now);
+}
+
+// The log ends: recorded players leave and it starts over after a pause
+void playback_finish(game_server_t *game, int64_t now) {
+    playback_t *playback = game->playback;
+
+    while (playback->count > 0)
+        playback_remove(game, playback->count - 1, 1);
+    playback->status = (replay_status_t){.state=WAITTING, .remain_ms=REPLAY_PAUSED};
+    playback->started = 0;
+    playback->restart = now + GAME_WAITTING_TIME * NS_PER_SEC;
+    game_broadcast_status(game);
+    printf("[INFO] Replay finished, restarting in %d s\n", GAME_WAITTING_TIME);
+}
+
+void playback_join(game_server_t *game, player_t *viewer, int64_t now) {
+    if (game->playback->started == 0 && game->playback->restart == 0)
+        playback_start(game, now);
+    else
+        playback_sync(game, viewer, now);
+}
+
+void playback_tick(game_server_t *game, int64_t now) {
+    playback_t *playback = game->playback;
+    uint32_t position;
+
+    if (playback->started == 0) {
+        if (playback->restart != 0 && now >= playback->restart && game->player_count > 0)
+            playback_start(game, now);
+        return;
+    }
+    position = playback->from_us + (now - playback->started) * playback->speed / 1000;
+    while (playback->pending && playback->event.time_us <= position) {
+        playback_apply(game, &playback->event, 1);
+        playback->pending = replay_next(&playback->reader, &playback->event);
+    }
+    if (!playback->pending)
+        playback_finish(game, now);
+}
+
+
+
+/////////// LEADERBOARD ////////////
+
+// WPM counts five characters as a word, over the race up to its finish line
+void game_record_results(game_server_t *game, player_t *winner, int64_t now) {
+    int64_t end = game->deadline != 0 && game->deadline < now ? game->deadline : now;
+    int64_t elapsed = end - game->started;
+    leaderboard_result_t result;
+    player_t *player;
+
+    if (game->board.wal < 0 || game->playback != NULL || elapsed <= 0)
+        return;
+    for (int i = 0; i < game->player_count; ++i) {
+        player = game->players + i;
+        if (player->info.mode != PLAYER || player->flagged)
+            continue;
+        result = (leaderboard_result_t){
+            .wpm=(uint64_t)player->typed_chars * 100 * 60 * NS_PER_SEC / 5 / elapsed,
+            .words=player->info.score,
+            .keys=player->keys,
+            .errors=player->errors < player->keys ? player->errors : player->keys,
+            .won=player == winner
+        };
+        memcpy(result.name, player->name, MAX_PLAYER_NAME_SIZE);
+        leaderboard_record(&game->board, &result);
+    }
+}
+
+static void player_send_leaderboard_row(game_server_t *game, player_t *player, uint32_t rank, const leaderboard_entry_t *entry) {
+    packet_t packet = {.id=SERVER_LEADERBOARD, .packet.server.leaderboard={
+        .rank=rank,
+        .total=leaderboard_size(&game->board)
+    }};
+
+    if (entry != NULL) {
+        packet.packet.server.leaderboard.wpm = entry->best_wpm;
+        packet.packet.server.leaderboard.accuracy = leaderboard_accuracy(entry);
+        packet.packet.server.leaderboard.races = entry->races > UINT16_MAX ? UINT16_MAX : entry->races;
+        memcpy(packet.packet.server.leaderboard.name, entry->name, MAX_PLAYER_NAME_SIZE);
+    }
+    net_send_packet(game, &packet, player);
+}
+
+void player_send_leaderboard(game_server_t *game, player_t *player, uint32_t count) {
+    const leaderboard_entry_t *top[MAX_LEADERBOARD_ROWS];
+    const leaderboard_entry_t *own = NULL;
+    uint32_t rank;
+    size_t found;
+
+    if (count > MAX_LEADERBOARD_ROWS)
+        count = MAX_LEADERBOARD_ROWS;
+    found = leaderboard_top(&game->board, top, count);
+    for (size_t i = 0; i < found; ++i)
+        player_send_leaderboard_row(game, player, i + 1, top[i]);
+    if ((rank = leaderboard_rank(&game->board, player->name, &own)) != 0)
+        player_send_leaderboard_row(game, player, rank, own);
+    player_send_leaderboard_row(game, player, 0, NULL);
+}
+
+
+
+/////////// HANDOFF ////////////
+
+// Upgrades: the new binary connects to the running server's upgrade socket.
+// Between two loop iterations the running server stops receiving, lets its
+// sends drain and passes every descriptor along with the room, in one
+// message. It exits once the new server acknowledged, and closing its end
+// of the socket then tells the new server the store is free. Nothing is
+// ever closed in between: bytes sent by clients meanwhile wait in their
+// sockets.
+
+#define     HANDOFF_MAGIC       0x4f485254  // "TRHO"
+#define     HANDOFF_VERSION     4
+#define     HANDOFF_TIMEOUT_MS  5000
+#define     HANDOFF_MAX_FDS     (MAX_PLAYERS + 4)
+
+typedef struct handoff_player_s
+{
+    player_info_t   info;
+    int             fd;
+    int             start_words;
+    char            name[MAX_PLAYER_NAME_SIZE];
+    int             current;
+    int             typing;
+    int             typed_chars;
+    uint32_t        keys;
+    uint32_t        errors;
+    int64_t         srtt;
+    int64_t         offset;
+    int64_t         next_ping;
+    int64_t         scored_at;
+    int             place;
+    int             flagged;
+    udp_channel_t   udp;
+    progress_t      progress;
+    session_t       session;
+    connection_t    connection;
+} handoff_player_t;
+
+// Descriptors are referred to by their position in the passed array
+typedef struct handoff_s
+{
+    uint32_t            magic;
+    uint32_t            version;
+    game_state_t        state;
+    int64_t             deadline;
+    int64_t             started;
+    int64_t             next_progress;
+    int                 races;
+    int                 next_player_id;
+    int                 last;
+    int                 fd_count;
+    int                 listener;
+    int                 udp;
+    int                 await;
+    connection_t        await_connection;
+    int                 gateway;
+    int                 gateway_id;
+    int                 player_count;
+    handoff_player_t    players[MAX_PLAYERS];
+    int                 standings[MAX_PLAYERS];
+    int                 standings_count;
+    int                 first[MAX_SCORE + 2];
+    int                 holders[MAX_SCORE + 2];
+} handoff_t;
+
+static int handoff_fd(int *fds, int *count, int fd) {
+    if (fd < 0)
+        return -1;
+    fds[*count] = fd;
+    return (*count)++;
+}
+
+static void handoff_pack(game_server_t *game, handoff_t *state, int *fds) {
+    player_t *player;
+
+    *state = (handoff_t){
+        .magic=HANDOFF_MAGIC,
+        .version=HANDOFF_VERSION,
+        .state=game->state,
+        .deadline=game->deadline,
+        .started=game->started,
+        .next_progress=game->next_progress,
+        .races=game->races,
+        .next_player_id=NEXT_PLAYER_ID,
+        .last=word_list_index(game->words, game->last),
+        .player_count=game->player_count,
+        .standings_count=game->standings.count
+    };
+    state->listener = handoff_fd(fds, &state->fd_count, game->socket);
+    state->udp = handoff_fd(fds, &state->fd_count, game->udp);
+    if ((state->await = handoff_fd(fds, &state->fd_count, game->await)) != -1)
+        state->await_connection = CONNECTIONS[game->await];
+    state->gateway = handoff_fd(fds, &state->fd_count, game->gateway);
+    state->gateway_id = game->gateway_id;
+    for (int i = 0; i < game->player_count; ++i) {
+        player = game->players + i;
+        state->players[i] = (handoff_player_t){
+            .info=player->info,
+            .fd=handoff_fd(fds, &state->fd_count, player->socket),
+            .start_words=player->start_words,
+            .current=word_list_index(game->words, player->current),
+            .typing=word_list_index(game->words, player->typing),
+            .typed_chars=player->typed_chars,
+            .keys=player->keys,
+            .errors=player->errors,
+            .srtt=player->srtt,
+            .offset=player->offset,
+            .next_ping=player->next_ping,
+            .scored_at=player->scored_at,
+            .place=player->place,
+            .flagged=player->flagged,
+            .udp=player->udp,
+            .progress=player->progress,
+            .session=player->session
+        };
+        if (player->socket != -1)
+            state->players[i].connection = CONNECTIONS[player->socket];
+        memcpy(state->players[i].name, player->name, MAX_PLAYER_NAME_SIZE);
+    }
+    for (int i = 0; i < game->standings.count; ++i)
+        state->standings[i] = game->standings.players[i] - game->players;
+    memcpy(state->first, game->standings.first, sizeof(state->first));
+    memcpy(state->holders, game->standings.holders, sizeof(state->holders));
+}
+
+static int handoff_send(int peer, const handoff_t *state, const int *fds) {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))] = {0};
+    struct iovec iov = {.iov_base=(void *)state, .iov_len=sizeof(handoff_t)};
+    struct msghdr msg = {.msg_iov=&iov, .msg_iovlen=1, .msg_control=control, .msg_controllen=CMSG_SPACE(state->fd_count * sizeof(int))};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    size_t sent;
+    ssize_t size;
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(state->fd_count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, state->fd_count * sizeof(int));
+    if ((size = sendmsg(peer, &msg, MSG_NOSIGNAL)) <= 0) {
+        perror("handoff sendmsg");
+        return -1;
+    }
+    for (sent = size; sent < sizeof(handoff_t); sent += size)
+        if ((size = send(peer, (const char *)state + sent, sizeof(handoff_t) - sent, MSG_NOSIGNAL)) <= 0) {
+            perror("handoff send");
+            return -1;
+        }
+    return 0;
+}
+
+// Runs on the old server, from the loop
+void game_handoff(game_server_t *game) {
+    struct pollfd pfd = {.fd=game->handoff, .events=POLLIN};
+    int fds[HANDOFF_MAX_FDS];
+    handoff_t state;
+    char ack = 0;
+
+    game->flags &= ~FLAG_HANDOFF;
+    printf("[INFO] Handing over to a new server\n");
+    reactor_quiesce(&game->reactor);
+    while (game->flags & FLAG_BROKEN_SOCK)
+        game_server_clean(game);
+    // Whatever removing broken players queued
+    reactor_quiesce(&game->reactor);
+    handoff_pack(game, &state, fds);
+    if (handoff_send(game->handoff, &state, fds) < 0
+        || poll(&pfd, 1, HANDOFF_TIMEOUT_MS) <= 0 || read(game->handoff, &ack, 1) != 1 || ack != 'A') {
+        fprintf(stderr, "[ERROR] Handoff failed, keeping the game\n");
+        close(game->handoff);
+        game->handoff = -1;
+        reactor_resume(&game->reactor);
+        return;
+    }
+    // The new server owns the race from here: not a word more from us
+    game_log_close(game, clock_now_ns());
+    game->flags |= FLAG_HANDED_OFF;
+    game->running = 0;
+    printf("[INFO] Handed %d players over\n", game->player_count);
+}
+
+static int handoff_connect(const char *path) {
+    struct sockaddr_un addr = {.sun_family=AF_UNIX};
+    int sockfd;
+
+    if (strlen(path) >= sizeof(addr.sun_path) || (sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    strcpy(addr.sun_path, path);
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static int handoff_read(int peer, handoff_t *state, int *fds) {
+    char control[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+    struct iovec iov = {.iov_base=state, .iov_len=sizeof(handoff_t)};
+    struct msghdr msg = {.msg_iov=&iov, .msg_iovlen=1, .msg_control=control, .msg_controllen=sizeof(control)};
+    struct cmsghdr *cmsg;
+    size_t received;
+    ssize_t size;
+    int count = 0;
+
+    if ((size = recvmsg(peer, &msg, MSG_CMSG_CLOEXEC)) <= 0) {
+        fprintf(stderr, "[ERROR] The running server refused the handoff\n");
+        return -1;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+        }
+    for (received = size; received < sizeof(handoff_t); received += size)
+        if ((size = read(peer, (char *)state + received, sizeof(handoff_t) - received)) <= 0) {
+            perror("handoff read");
+            break;
+        }
+    if (received < sizeof(handoff_t) || (msg.msg_flags & MSG_CTRUNC) || state->magic != HANDOFF_MAGIC
+        || state->version != HANDOFF_VERSION || state->fd_count != count || state->player_count > MAX_PLAYERS
+        || state->standings_count > state->player_count || state->listener == -1) {
+        fprintf(stderr, "[ERROR] Invalid handoff from the running server\n");
+        for (int i = 0; i < count; ++i)
+            close(fds[i]);
+        return -1;
+    }
+    return 0;
+}
+
+// A handed over socket the reactor refuses is dropped like a broken one
+static int handoff_watch(game_server_t *game, int socket, const connection_t *connection) {
+    if (socket < 0 || socket >= FD_SETSIZE || reactor_watch(&game->reactor, socket) < 0) {
+        game->flags |= FLAG_BROKEN_SOCK;
+        return -1;
+    }
+    CONNECTIONS[socket] = *connection;
+    CONNECTIONS[socket].open = 1;
+    return 0;
+}
+
+static void handoff_unpack(game_server_t *game, const handoff_t *state, const int *fds) {
+    const handoff_player_t *saved;
+    player_t *player;
+
+    game->state = state->state;
+    game->deadline = state->deadline;
+    game->started = state->started;
+    game->next_progress = state->next_progress;
+    game->races = state->races;
+    game->last = state->last != -1 ? word_list_at(game->words, state->last) : game->words;
+    NEXT_PLAYER_ID = state->next_player_id;
+    game->socket = fds[state->listener];
+    reactor_listen(&game->reactor, game->socket);
+    if (state->udp != -1 && reactor_poll(&game->reactor, fds[state->udp]) == 0)
+        game->udp = fds[state->udp];
+    if (state->await != -1 && handoff_watch(game, fds[state->await], &state->await_connection) == 0)
+        game->await = fds[state->await];
+    if (state->gateway != -1 && reactor_poll(&game->reactor, fds[state->gateway]) == 0) {
+        game->gateway = fds[state->gateway];
+        game->gateway_id = state->gateway_id;
+    }
+    game->player_count = state->player_count;
+    for (int i = 0; i < state->player_count; ++i) {
+        saved = state->players + i;
+        player = game->players + i;
+        *player = (player_t){
+            .info=saved->info,
+            .socket=saved->fd != -1 ? fds[saved->fd] : -1,
+            .status=STABLE,
+            .start_words=saved->start_words,
+            .current=word_list_at(game->words, saved->current),
+            .typing=word_list_at(game->words, saved->typing),
+            .typed_chars=saved->typed_chars,
+            .keys=saved->keys,
+            .errors=saved->errors,
+            .srtt=saved->srtt,
+            .offset=saved->offset,
+            .next_ping=saved->next_ping,
+            .scored_at=saved->scored_at,
+            .place=saved->place,
+            .flagged=saved->flagged,
+            .udp=saved->udp,
+            .progress=saved->progress,
+            .session=saved->session
+        };
+        memcpy(player->name, saved->name, MAX_PLAYER_NAME_SIZE);
+        // Detached, waiting for its client to resume
+        if (player->socket == -1)
+            player->status = CLOSED;
+        else if (handoff_watch(game, player->socket, &saved->connection) < 0)
+            player->status = BROKEN;
+    }
+    game->standings.count = state->standings_count;
+    for (int i = 0; i < state->standings_count; ++i)
+        game->standings.players[i] = game->players + state->standings[i];
+    memcpy(game->standings.first, state->first, sizeof(state->first));
+    memcpy(game->standings.holders, state->holders, sizeof(state->holders));
+}
+
+// Runs on the new server at startup, < 0 when there is nobody to take over
+int handoff_receive(game_server_t *game, const char *path) {
+    int fds[HANDOFF_MAX_FDS];
+    handoff_t state;
+    int peer;
+
+    if ((peer = handoff_connect(path)) < 0)
+        return -1;
+    printf("[INFO] Taking over from the server on %s\n", path);
+    if (handoff_read(peer, &state, fds) < 0) {
+        close(peer);
+        game_server_destroy(game);
+        exit(EXIT_FAILURE);
+    }
+    handoff_unpack(game, &state, fds);
+    if (write(peer, "A", 1) != 1 || reactor_poll(&game->reactor, peer) < 0) {
+        perror("handoff ack");
+        close(peer);
+        game_server_destroy(game);
+        exit(EXIT_FAILURE);
+    }
+    game->handoff = peer;
+    printf("[INFO] Took over %d players, game %s\n", game->player_count, game->state == RUNNING ? "running" : "waiting");
+    return 0;
+}
+
+// The old server is gone and so is its hold on the store
+void handoff_released(game_server_t *game) {
+    char byte;
+
+    if (read(game->handoff, &byte, 1) > 0)
+        return;
+    reactor_close(&game->reactor, game->handoff);
+    game->handoff = -1;
+    if (game->store_dir != NULL && leaderboard_open(&game->board, game->store_dir) < 0)
+        fprintf(stderr, "[ERROR] Results will not be recorded\n");
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un addr = {.sun_family=AF_UNIX};
+    int sockfd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "[ERROR] Upgrade socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if ((sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sockfd, 1) < 0) {
+        perror("upgrade bind");
+        close(sockfd);
+        return -1;
+    }
+    printf("[INFO] Upgrades accepted on %s\n", path);
+    return sockfd;
+}
+
+
+
+/////////// GATEWAY ////////////
+
+static int gateway_send(game_server_t *game, gateway_msg_type_t type, uint32_t value) {
+    gateway_msg_t msg = {.type=type, .value=value};
+
+    if (game->gateway == -1)
+        return -1;
+    return send(game->gateway, &msg, sizeof(msg), MSG_NOSIGNAL) == sizeof(msg) ? 0 : -1;
+}
+
+// Registers this room with the gateway, which answers with our id
+int gateway_connect(game_server_t *game, const char *path) {
+    gateway_msg_t msg;
+
+    if ((game->gateway = handoff_connect(path)) < 0) {
+        fprintf(stderr, "[ERROR] Could not reach the gateway on %s\n", path);
+        return -1;
+    }
+    if (gateway_send(game, GATEWAY_REGISTER, MAX_PLAYERS) < 0
+        || recv(game->gateway, &msg, sizeof(msg), MSG_WAITALL) != sizeof(msg) || msg.type != GATEWAY_WELCOME
+        || reactor_poll(&game->reactor, game->gateway) < 0) {
+        fprintf(stderr, "[ERROR] The gateway on %s refused us\n", path);
+        close(game->gateway);
+        game->gateway = -1;
+        return -1;
+    }
+    game->gateway_id = msg.value;
+    printf("[INFO] Serving players from the gateway on %s as backend %d\n", path, game->gateway_id);
+    return 0;
+}
+
+// A player routed to us: taken in as if accepted here, then its first packet
+void gateway_read(game_server_t *game) {
+    char control[CMSG_SPACE(sizeof(int))] = {0};
+    gateway_msg_t msg;
+    struct iovec iov = {.iov_base=&msg, .iov_len=sizeof(msg)};
+    struct msghdr hdr = {.msg_iov=&iov, .msg_iovlen=1, .msg_control=control, .msg_controllen=sizeof(control)};
+    struct cmsghdr *cmsg;
+    int socket = -1;
+
+    if (recvmsg(game->gateway, &hdr, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(msg)) {
+        fprintf(stderr, "[ERROR] Lost the gateway, the room only takes direct connections now\n");
+        reactor_close(&game->reactor, game->gateway);
+        game->gateway = -1;
+        return;
+    }
+    if ((cmsg = CMSG_FIRSTHDR(&hdr)) != NULL && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&socket, CMSG_DATA(cmsg), sizeof(int));
+    if (msg.type != GATEWAY_PLAYER || socket < 0) {
+        if (socket >= 0)
+            close(socket);
+        return;
+    }
+    // The gateway counted this player in: our next report sets it right,
+    // even when the count did not move (resumed seats, refused joins)
+    game->gateway_load = -1;
+    net_client_accept(game, game->socket, socket);
+    if (socket == game->await && !packet_from_client(msg.packet.id)) {
+        METRICS.protocol_errors++;
+        net_client_evict(game, socket);
+    } else if (socket == game->await)
+        game_handle_packet(game, socket, &msg.packet);
+}
+
+// Occupancy drives the gateway's placement: sent whenever it changed and
+// after every routed player. A room out of memory headroom shows as full.
+void gateway_report(game_server_t *game) {
+    int load = mem_room_available() ? game->player_count : MAX_PLAYERS;
+
+    if (game->gateway == -1 || game->gateway_load == load)
+        return;
+    if (gateway_send(game, GATEWAY_LOAD, load) == 0)
+        game->gateway_load = load;
+}
+
+uint64_t gateway_token(game_server_t *game, uint64_t token) {
+    if (game->gateway_id == 0 || token == 0)
+        return token;
+    return (token & ~(0xffull << GATEWAY_BACKEND_SHIFT)) | (uint64_t)game->gateway_id << GATEWAY_BACKEND_SHIFT;
+}
+
+// No new players from now on, the server leaves once its room is empty
+void game_drain(game_server_t *game) {
+    if (!(game->flags & FLAG_DRAINING)) {
+        game->flags |= FLAG_DRAINING;
+        printf("[INFO] Draining, %d players left\n", game->player_count);
+        if (gateway_send(game, GATEWAY_DRAIN, 0) < 0 && game->gateway != -1)
+            fprintf(stderr, "[ERROR] Could not tell the gateway we are draining\n");
+    }
+    if (game->player_count == 0) {
+        printf("[INFO] Drained\n");
+        game->running = 0;
+    }
+}
+
+
+
+/////////// SIGNAL ////////////
 
 static int *SHUTDOWN = NULL;
-static int *REMAIN = NULL;
-static const struct itimerval TIMER = {
-    .it_interval={.tv_sec=1, .tv_usec=0},
-    .it_value={.tv_sec=1, .tv_usec=0}
-};
 
 void signal_handler(int signal) {
     if (SHUTDOWN == NULL)
@@ -528,22 +2206,88 @@ void signal_handler(int signal) {
     }
 }
 
-void alarm_handler(int signal) {
-    if (signal == SIGALRM && REMAIN != NULL && *REMAIN > 0) {
-        *REMAIN -= TIMER.it_value.tv_sec;
-    }
+void drain_handler(int signal) {
+    (void)signal;
+    DRAIN = 1;
 }
 
 
 /////////// MAIN ////////////
 
-static const char USAGE[] = "./server [host] [port] [file]\n";
+// The fuzz harness includes this file and drives the game itself
+#ifndef FUZZ
+
+static const char USAGE[] = "./server [-a admin_socket] [-r select|uring] [-t] [-l log_dir] [-d store_dir] [-u upgrade_socket] [-g gateway_socket] [-m budget_mb] [-p replay [-x speed] [-s seek]] [host] [port] [file]\n";
 
 int main(int ac, char **av) {
     game_server_t game;
+    const char *admin_path = NULL;
+    const char *reactor = "select";
+    const char *log_dir = NULL;
+    const char *store_dir = NULL;
+    const char *upgrade_path = NULL;
+    const char *gateway_path = NULL;
+    const char *replay = NULL;
+    double speed = 1;
+    double seek = 0;
     int port;
+    int opt;
+
+    while ((opt = getopt(ac, av, "a:r:tl:d:u:g:m:p:x:s:")) != -1) {
+        switch (opt)
+        {
+        case 'a':
+            admin_path = optarg;
+            break;
+
+        case 'r':
+            reactor = optarg;
+            break;
 
-    if (ac != 4) {
+        case 't':
+            TIMING_CHECKS = 0;
+            break;
+
+        case 'l':
+            log_dir = optarg;
+            break;
+
+        case 'd':
+            store_dir = optarg;
+            break;
+
+        case 'u':
+            upgrade_path = optarg;
+            break;
+
+        case 'g':
+            gateway_path = optarg;
+            break;
+
+        case 'm':
+            MEMORY.limit = strtoul(optarg, NULL, 10) << 20;
+            break;
+
+        case 'p':
+            replay = optarg;
+            break;
+
+        case 'x':
+            speed = strtod(optarg, NULL);
+            break;
+
+        case 's':
+            seek = strtod(optarg, NULL);
+            break;
+
+        default:
+            fprintf(stderr, USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    ac -= optind - 1;
+    av += optind - 1;
+    if (ac != 4 || speed <= 0 || seek < 0 || MEMORY.limit == 0) {
         fprintf(stderr, USAGE);
         exit(EXIT_FAILURE);
     }
@@ -554,12 +2298,18 @@ int main(int ac, char **av) {
         exit(EXIT_FAILURE);
     }
     signal(SIGINT, signal_handler);
-    signal(SIGALRM, alarm_handler);
-    setitimer(ITIMER_REAL, &TIMER, NULL);
-    game_server_init(&game, av[1], port, av[3]);
+    signal(SIGUSR1, drain_handler);
+    // io_uring writes cannot take MSG_NOSIGNAL: a reset peer must fail the
+    // send, not end the server
+    signal(SIGPIPE, SIG_IGN);
+    game_server_init(&game, av[1], port, av[3], admin_path, reactor, replay == NULL ? log_dir : NULL,
+        replay == NULL ? store_dir : NULL, replay == NULL ? upgrade_path : NULL, replay == NULL ? gateway_path : NULL);
+    if (replay != NULL)
+        playback_init(&game, replay, speed, seek);
     SHUTDOWN = &game.running;
-    REMAIN = &game.time_remain;
     game_server_start(&game);
     game_server_destroy(&game);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+#endif